@@ -0,0 +1,138 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// The arithmetic UpdateRP evaluates bindings with.  Nothing here touches
+// devices or pads, so it can be checked on its own.
+
+// Button binding state, scaled the way UpdateRP compares it to the dead
+// zone.  FULLY_DOWN at BASE_SENSITIVITY is 127.
+static inline int ScaleButtonState(int sensitivity, int state) {
+	return (int)((((sensitivity*(127 * (__int64)state)) + BASE_SENSITIVITY / 2) / BASE_SENSITIVITY + FULLY_DOWN / 2) / FULLY_DOWN);
+}
+
+// A binding's dead zone in ScaleButtonState() units.
+static inline int ButtonDeadZone(int deadZone) {
+	return (int)((127 * (__int64)deadZone + BASE_SENSITIVITY / 2) / BASE_SENSITIVITY);
+}
+
+// How far past their dead zone analog controls bound to buttons have to go
+// to press them, in ScaleButtonState() units.
+#define BUTTON_HYSTERESIS 8
+
+// Whether a button is down, given its binding's scaled state and whether it
+// was down before.  Analog controls have to get a bit past the dead zone to
+// press, so one resting near it doesn't toggle the button every frame.
+static inline bool ButtonDown(bool wasDown, int state, int deadZone, bool analog) {
+	int releaseAt = ButtonDeadZone(deadZone);
+	int pressAt = analog ? releaseAt + BUTTON_HYSTERESIS : releaseAt;
+	if (state > pressAt) return true;
+	if (state <= releaseAt) return false;
+	return wasDown;
+}
+
+// Buttons each source is holding on a pad.  The host gets their OR, so one
+// source letting go of a button leaves it down if another's still holding
+// it.
+struct ButtonSources {
+	// The per binding code's.  Its bindings press and release on changes, so
+	// this carries over between frames.
+	u32 bindings;
+	// Devices' plain key bindings, rebuilt every frame.
+	u32 matrix;
+	// Turbo's, on its press phase.
+	u32 turbo;
+	u32 combos;
+	// Updates each turbo button has been held for.
+	u32 turboFrames[18];
+};
+
+static inline u32 SourceButtons(const ButtonSources *s) {
+	return s->bindings | s->matrix | s->turbo | s->combos;
+}
+
+// Turbo buttons are pressed for TURBO_FRAMES updates, then released for as
+// many, starting with a press, for as long as they're held.  Counted in
+// updates rather than time, so the same input always fires the same way.
+#define TURBO_FRAMES 2
+
+static inline void StepTurbo(ButtonSources *s, u32 held) {
+	u32 buttons = 0;
+	for (int i = 0; i < 18; i++) {
+		if (!(held & (1 << i))) {
+			s->turboFrames[i] = 0;
+			continue;
+		}
+		if (!((s->turboFrames[i]++ / TURBO_FRAMES) & 1))
+			buttons |= 1 << i;
+	}
+	s->turbo = buttons;
+}
+
+// What SetStickAxis() keeps about an axis over a frame.  Zeroed at the
+// start of each one.
+struct StickAxisFrame {
+	bool written;
+	// What the host had before the frame.
+	bool wasUpdated;
+	int start;
+};
+
+// Anything non-zero wins, and zero only if nothing's set the axis yet this
+// frame.  updated is only raised when the value the host gets ends up
+// different from the last frame's, so bindings that disagree part way
+// through a frame, or input that jitters without changing the output,
+// don't flag an update.  It's never cleared, that's left to the host.
+static inline void SetStickAxis(int &axis, bool &updated, StickAxisFrame &frame, int value) {
+	if (!frame.written) {
+		frame.written = true;
+		frame.wasUpdated = updated;
+		frame.start = axis;
+	}
+	else if (!value) return;
+	axis = value;
+	updated = frame.wasUpdated || axis != frame.start;
+}
+
+// Fills in one stick's StickProcessor::curve for a radial dead zone and an
+// exponent, both in BASE_SENSITIVITY units.  An exponent of 0 is linear.
+static inline void BuildStickCurve(u16 *curve, int deadZone, int exponent) {
+	double dz = (double)deadZone / BASE_SENSITIVITY;
+	double exp = exponent ? (double)exponent / BASE_SENSITIVITY : 1;
+	for (int i = 0; i <= STICK_CURVE_LEN; i++) {
+		double r = (double)i / STICK_CURVE_LEN;
+		double t = 0;
+		if (r > dz) t = (r - dz) / (1 - dz);
+		curve[i] = (u16)(pow(t, exp) * 127 * 256 + 0.5);
+	}
+}
+
+// Maps a stick's direction, with FULLY_DOWN as all the way, through its
+// curve.  The direction is kept and the magnitude comes out of 127.
+static inline void ApplyStickCurve(const u16 *curve, int x, int y, int &outX, int &outY) {
+	outX = outY = 0;
+	__int64 r2 = (__int64)x * x + (__int64)y * y;
+	if (!r2) return;
+	int r = (int)sqrt((double)r2);
+	int index = r / (FULLY_DOWN / STICK_CURVE_LEN);
+	if (index > STICK_CURVE_LEN) index = STICK_CURVE_LEN;
+	__int64 scale = (__int64)r << 8;
+	outX = (int)(x * (__int64)curve[index] / scale);
+	outY = (int)(y * (__int64)curve[index] / scale);
+}
@@ -0,0 +1,367 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "InputManager.h"
+#include "Combo.h"
+
+// How long a finished sequence holds its button down.
+#define COMBO_TAP_MS 100
+
+Combo *combos = 0;
+int numCombos = 0;
+
+static const wchar_t *const comboTypeNames[] = { L"chord", L"sequence", L"layer" };
+
+// A control used by at least one combo.  Its index is its symbol in the
+// sequence DFA.
+struct ComboWatch {
+	Device *dev;
+	int controlIndex;
+	u8 pressed;
+};
+
+static struct ComboTable {
+	// What the table was compiled against.
+	unsigned int bindingGeneration;
+	unsigned int deviceGeneration;
+
+	int numWatches;
+	ComboWatch *watches;
+	// Chords and layers each watch is in are chordRefs[chordStart[w]] up to
+	// chordRefs[chordStart[w + 1]].
+	int *chordStart;
+	int *chordRefs;
+	// How many of each chord's inputs are held.  -1 for combos with an input
+	// that couldn't be found, which never fire.
+	int *held;
+
+	// Sequence DFA, with numWatches entries per state in next.  0 is the
+	// start state.
+	int numStates;
+	int *next;
+	// The sequence that ends at each state, or -1.
+	int *finished;
+	// Longest proper suffix state that ends a sequence, or 0 if none.
+	int *finishedLink;
+	// Longest timeout of the sequences passing through each state.
+	int *timeout;
+	int state;
+	u32 lastPress;
+
+	// Number of chords holding each button, by pad and layer.
+	u8 buttons[2][4][COMBO_LAYERS][18];
+	// Number of layer combos holding each layer, by pad.
+	u8 layers[2][4][COMBO_LAYERS];
+	// Buttons pressed by finished sequences, and when each is released.
+	u32 taps[2][4];
+	u32 tapEnd[2][4][18];
+} table;
+
+int ParseCombo(const wchar_t *text, Combo *combo, int devices[COMBO_MAX_INPUTS]) {
+	char string[1000];
+	int w = 0;
+	while (text[w] && w < 999) {
+		string[w] = (char)text[w];
+		w++;
+	}
+	string[w] = 0;
+
+	char type[20];
+	int port, slot, layer, command, timeout, len = 0;
+	if (sscanf(string, " %19[a-z] , %i , %i , %i , %i , %i%n", type, &port, &slot, &layer, &command, &timeout, &len) < 6)
+		return 0;
+	int numTypes = sizeof(comboTypeNames) / sizeof(comboTypeNames[0]);
+	int t;
+	for (t = 0; t < numTypes; t++) {
+		int i = 0;
+		while (type[i] && type[i] == comboTypeNames[t][i]) i++;
+		if (!type[i] && !comboTypeNames[t][i]) break;
+	}
+	if (t == numTypes) return 0;
+	if (port < 0 || port > 1 || slot < 0 || slot > 3 || layer < 0 || layer >= COMBO_LAYERS) return 0;
+	if (t == COMBO_LAYER) {
+		if (layer || command < 1 || command >= COMBO_LAYERS) return 0;
+	}
+	// Only buttons.
+	else if (command < 0x10 || command >= 34) {
+		return 0;
+	}
+
+	memset(combo, 0, sizeof(*combo));
+	combo->type = t;
+	combo->port = port;
+	combo->slot = slot;
+	combo->layer = layer;
+	combo->command = command;
+	combo->timeout = timeout;
+	const char *s = string + len;
+	while (combo->numInputs < COMBO_MAX_INPUTS) {
+		int device;
+		unsigned int uid;
+		if (sscanf(s, " , %i , %x%n", &device, &uid, &len) < 2) break;
+		devices[combo->numInputs] = device;
+		combo->inputs[combo->numInputs++].uid = uid;
+		s += len;
+	}
+	return combo->numInputs > 0;
+}
+
+int FormatCombo(const Combo *combo, wchar_t *out, int size) {
+	int len = swprintf(out, size, L"%ls, %i, %i, %i, %i, %i", comboTypeNames[combo->type], combo->port, combo->slot, combo->layer, combo->command, combo->timeout);
+	for (int i = 0; i < combo->numInputs; i++) {
+		int device;
+		for (device = 0; device < dm->numDevices; device++) {
+			if (!wcsicmp(dm->devices[device]->instanceID, combo->inputs[i].instanceID)) break;
+		}
+		if (device == dm->numDevices || len < 0 || len >= size) return 0;
+		len += swprintf(out + len, size - len, L", %i, 0x%08X", device, combo->inputs[i].uid);
+	}
+	return len > 0 && len < size;
+}
+
+void AddCombo(const Combo *combo) {
+	combos = (Combo*)realloc(combos, (numCombos + 1) * sizeof(Combo));
+	combos[numCombos++] = *combo;
+	bindingGeneration++;
+}
+
+void ClearCombos() {
+	for (int i = 0; i < numCombos; i++) {
+		for (int j = 0; j < combos[i].numInputs; j++) {
+			free(combos[i].inputs[j].instanceID);
+		}
+	}
+	free(combos);
+	combos = 0;
+	numCombos = 0;
+	bindingGeneration++;
+}
+
+static Device *FindComboDevice(const wchar_t *instanceID) {
+	for (int i = 0; i < dm->numDevices; i++) {
+		if (!wcsicmp(dm->devices[i]->instanceID, instanceID))
+			return dm->devices[i];
+	}
+	return 0;
+}
+
+static void CompileCombos() {
+	ComboTable *t = &table;
+	int maxWatches = numCombos * COMBO_MAX_INPUTS;
+	// Each input's watch, or -1.
+	int *symbols = (int*)malloc((maxWatches + 1) * sizeof(int));
+	t->watches = (ComboWatch*)realloc(t->watches, (maxWatches + 1) * sizeof(ComboWatch));
+	t->held = (int*)realloc(t->held, (numCombos + 1) * sizeof(int));
+	t->numWatches = 0;
+	int maxStates = 1;
+	for (int c = 0; c < numCombos; c++) {
+		Combo *combo = combos + c;
+		t->held[c] = 0;
+		for (int i = 0; i < combo->numInputs; i++) {
+			int *symbol = symbols + c * COMBO_MAX_INPUTS + i;
+			*symbol = -1;
+			Device *dev = FindComboDevice(combo->inputs[i].instanceID);
+			VirtualControl *control = dev ? dev->GetVirtualControl(combo->inputs[i].uid) : 0;
+			if (!control) {
+				t->held[c] = -1;
+				continue;
+			}
+			int controlIndex = control - dev->virtualControls;
+			int w;
+			for (w = 0; w < t->numWatches; w++) {
+				if (t->watches[w].dev == dev && t->watches[w].controlIndex == controlIndex) break;
+			}
+			if (w == t->numWatches) {
+				t->watches[w].dev = dev;
+				t->watches[w].controlIndex = controlIndex;
+				t->watches[w].pressed = 0;
+				t->numWatches++;
+			}
+			*symbol = w;
+		}
+		if (combo->type == COMBO_SEQUENCE) maxStates += combo->numInputs;
+	}
+
+	// Chord references, grouped by watch.
+	t->chordStart = (int*)realloc(t->chordStart, (t->numWatches + 2) * sizeof(int));
+	memset(t->chordStart, 0, (t->numWatches + 2) * sizeof(int));
+	for (int c = 0; c < numCombos; c++) {
+		if (combos[c].type == COMBO_SEQUENCE || t->held[c] < 0) continue;
+		for (int i = 0; i < combos[c].numInputs; i++)
+			t->chordStart[symbols[c * COMBO_MAX_INPUTS + i] + 2]++;
+	}
+	for (int w = 0; w < t->numWatches; w++)
+		t->chordStart[w + 2] += t->chordStart[w + 1];
+	t->chordRefs = (int*)realloc(t->chordRefs, (t->chordStart[t->numWatches + 1] + 1) * sizeof(int));
+	// chordStart[w + 1] is used as the fill position for watch w, and ends
+	// up where watch w + 1 starts.
+	for (int c = 0; c < numCombos; c++) {
+		if (combos[c].type == COMBO_SEQUENCE || t->held[c] < 0) continue;
+		for (int i = 0; i < combos[c].numInputs; i++)
+			t->chordRefs[t->chordStart[symbols[c * COMBO_MAX_INPUTS + i] + 1]++] = c;
+	}
+
+	// Sequences go into a trie first, with -1 for missing edges.
+	int width = t->numWatches;
+	t->next = (int*)realloc(t->next, (maxStates * width + 1) * sizeof(int));
+	t->finished = (int*)realloc(t->finished, maxStates * sizeof(int));
+	t->finishedLink = (int*)realloc(t->finishedLink, maxStates * sizeof(int));
+	t->timeout = (int*)realloc(t->timeout, maxStates * sizeof(int));
+	for (int i = 0; i < width; i++)
+		t->next[i] = -1;
+	t->finished[0] = -1;
+	t->finishedLink[0] = 0;
+	t->timeout[0] = 0;
+	t->numStates = 1;
+	for (int c = 0; c < numCombos; c++) {
+		if (combos[c].type != COMBO_SEQUENCE || t->held[c] < 0) continue;
+		int state = 0;
+		for (int i = 0; i < combos[c].numInputs; i++) {
+			int *edge = t->next + state * width + symbols[c * COMBO_MAX_INPUTS + i];
+			if (*edge < 0) {
+				int n = t->numStates++;
+				for (int j = 0; j < width; j++)
+					t->next[n * width + j] = -1;
+				t->finished[n] = -1;
+				t->timeout[n] = 0;
+				*edge = n;
+			}
+			state = *edge;
+			if (combos[c].timeout > t->timeout[state]) t->timeout[state] = combos[c].timeout;
+		}
+		t->finished[state] = c;
+	}
+
+	// Then filled in breadth first, Aho-Corasick style, so every state has
+	// an edge for every watch.
+	int *fail = (int*)malloc(t->numStates * sizeof(int));
+	int *queue = (int*)malloc(t->numStates * sizeof(int));
+	int head = 0, tail = 0;
+	for (int i = 0; i < width; i++) {
+		int n = t->next[i];
+		if (n < 0) {
+			t->next[i] = 0;
+			continue;
+		}
+		fail[n] = 0;
+		t->finishedLink[n] = 0;
+		queue[tail++] = n;
+	}
+	while (head < tail) {
+		int state = queue[head++];
+		for (int i = 0; i < width; i++) {
+			int *edge = t->next + state * width + i;
+			int fallback = t->next[fail[state] * width + i];
+			if (*edge < 0) {
+				*edge = fallback;
+				continue;
+			}
+			int n = *edge;
+			fail[n] = fallback;
+			t->finishedLink[n] = t->finished[fallback] >= 0 ? fallback : t->finishedLink[fallback];
+			queue[tail++] = n;
+		}
+	}
+	free(fail);
+	free(queue);
+	free(symbols);
+
+	t->state = 0;
+	memset(t->buttons, 0, sizeof(t->buttons));
+	memset(t->layers, 0, sizeof(t->layers));
+	memset(t->taps, 0, sizeof(t->taps));
+	t->bindingGeneration = bindingGeneration;
+	t->deviceGeneration = deviceGeneration;
+}
+
+static int ActiveLayer(unsigned int port, unsigned int slot) {
+	for (int layer = COMBO_LAYERS - 1; layer > 0; layer--) {
+		if (table.layers[port][slot][layer]) return layer;
+	}
+	return 0;
+}
+
+static void SetChord(int c, int delta) {
+	Combo *combo = combos + c;
+	if (combo->type == COMBO_LAYER)
+		table.layers[combo->port][combo->slot][combo->command] += delta;
+	else
+		table.buttons[combo->port][combo->slot][combo->layer][combo->command - 0x10] += delta;
+}
+
+static void StepSequences(int watch, u32 now) {
+	if (table.state && now - table.lastPress > (u32)table.timeout[table.state])
+		table.state = 0;
+	table.state = table.next[table.state * table.numWatches + watch];
+	table.lastPress = now;
+	int state = table.finished[table.state] >= 0 ? table.state : table.finishedLink[table.state];
+	while (state) {
+		Combo *combo = combos + table.finished[state];
+		if (!combo->layer || combo->layer == ActiveLayer(combo->port, combo->slot)) {
+			int button = combo->command - 0x10;
+			table.taps[combo->port][combo->slot] |= 1 << button;
+			table.tapEnd[combo->port][combo->slot][button] = now + COMBO_TAP_MS;
+		}
+		state = table.finishedLink[state];
+	}
+}
+
+void UpdateCombos(u32 now) {
+	if (!numCombos || !dm) return;
+	if (table.bindingGeneration != bindingGeneration || table.deviceGeneration != deviceGeneration)
+		CompileCombos();
+	for (int w = 0; w < table.numWatches; w++) {
+		ComboWatch *watch = table.watches + w;
+		int *state = watch->dev->virtualControlState;
+		u8 pressed = watch->dev->active && state && state[watch->controlIndex] > FULLY_DOWN / 2;
+		if (pressed == watch->pressed) continue;
+		watch->pressed = pressed;
+		for (int i = table.chordStart[w]; i < table.chordStart[w + 1]; i++) {
+			int c = table.chordRefs[i];
+			if (pressed) {
+				if (++table.held[c] == combos[c].numInputs) SetChord(c, 1);
+			}
+			else {
+				if (table.held[c]-- == combos[c].numInputs) SetChord(c, -1);
+			}
+		}
+		if (pressed && table.numStates > 1)
+			StepSequences(w, now);
+	}
+}
+
+u32 ComboButtons(unsigned int port, unsigned int slot, u32 now) {
+	if (!numCombos) return 0;
+	int layer = ActiveLayer(port, slot);
+	u32 buttons = 0;
+	for (int i = 0; i < 18; i++) {
+		if (table.buttons[port][slot][0][i] || (layer && table.buttons[port][slot][layer][i]))
+			buttons |= 1 << i;
+	}
+	u32 taps = table.taps[port][slot];
+	for (int i = 0; i < 18; i++) {
+		if (!(taps & (1 << i))) continue;
+		if ((s32)(table.tapEnd[port][slot][i] - now) > 0)
+			buttons |= 1 << i;
+		else
+			taps &= ~(1 << i);
+	}
+	table.taps[port][slot] = taps;
+	return buttons;
+}
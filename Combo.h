@@ -0,0 +1,85 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Bindings with more than one input, possibly from different devices:
+//
+//   Chords hold a button while all of their inputs are held.
+//   Sequences tap a button when their inputs are pressed in order, each
+//     within timeout ms of the last.
+//   Layers are chords that switch to another set of combos while held.
+//     Only layer 0's combos and the active layer's fire.  Layers only
+//     switch combos.  Ordinary bindings are the same on every layer.
+//
+// Saved in the [Combos] section, one per line:
+//   Combo 0 = chord, port, slot, layer, command, timeout, device, uid, ...
+// where device is the number of the "Device N" section the control's uid
+// belongs to, and command is the layer number for layers.
+//
+// All combos are compiled into one table of watched controls, each watched
+// once however many combos use it.  Every update compares each watched
+// control's state with the last, and only the ones that changed go on to
+// the chords that use them.  Each press steps every sequence at once
+// through a single DFA, so sequences cost the same however many there are.
+
+#define COMBO_MAX_INPUTS 8
+#define COMBO_LAYERS 4
+
+enum ComboType {
+	COMBO_CHORD,
+	COMBO_SEQUENCE,
+	COMBO_LAYER
+};
+
+struct ComboInput {
+	// Of the device, so combos survive devices being enumerated again.
+	wchar_t *instanceID;
+	unsigned int uid;
+};
+
+struct Combo {
+	u8 type;
+	u8 port;
+	u8 slot;
+	u8 layer;
+	int command;
+	int timeout;
+	int numInputs;
+	ComboInput inputs[COMBO_MAX_INPUTS];
+};
+
+extern Combo *combos;
+extern int numCombos;
+
+// Reads everything but the instance IDs, which the caller fills in from the
+// Device sections given in devices.  Returns 0 if the line's no good.
+int ParseCombo(const wchar_t *text, Combo *combo, int devices[COMBO_MAX_INPUTS]);
+// Formats the combo for saving, with dm's indices as device numbers.
+// Returns 0 if one of its devices isn't in dm.
+int FormatCombo(const Combo *combo, wchar_t *out, int size);
+
+// Takes ownership of the instance IDs.
+void AddCombo(const Combo *combo);
+void ClearCombos();
+
+// Checks the watched controls for changes.  Must be called after devices
+// are updated, and before bindings write scaled values over their state.
+void UpdateCombos(u32 now);
+// Buttons combos are holding on the given pad.
+u32 ComboButtons(unsigned int port, unsigned int slot, u32 now);
@@ -23,6 +23,9 @@
 
 #include "Diagnostics.h"
 #include "DeviceEnumerator.h"
+#include "Trace.h"
+#include "Log.h"
+#include "Combo.h"
 #include "KeyboardQueue.h"
 #include "WndProcEater.h"
 #include "DualShock4.h"
@@ -690,6 +693,7 @@ void ChangeValue(int port, int slot, int *newSensitivity, int *newTurbo, int *ne
 			b->turbo = *newTurbo;
 		}
 	}
+	bindingGeneration++;
 	PropSheet_Changed(hWndProp, hWnds[port][slot]);
 	SelChanged(port, slot);
 }
@@ -868,6 +872,12 @@ int SaveSettings(wchar_t *file = 0) {
 			}
 		}
 	}
+	for (int i = 0; i < numCombos; i++) {
+		wchar_t temp[50], temp2[1000];
+		wsprintfW(temp, L"Combo %i", i);
+		if (FormatCombo(combos + i, temp2, 1000))
+			WritePrivateProfileStringW(L"Combos", temp, temp2, file);
+	}
 	if (!noError) {
 		MessageBoxA(hWndProp, "Unable to save settings.  Make sure the disk is not full or write protected, the file isn't write protected, and that the app has permissions to write to the directory.  On Vista, try running in administrator mode.", "Error Writing Configuration File", MB_OK | MB_ICONERROR);
 	}
@@ -880,6 +890,7 @@ u8 GetPrivateProfileBool(wchar_t *s1, wchar_t *s2, int def, wchar_t *ini) {
 
 int LoadSettings(int force, wchar_t *file) {
 	if (dm && !force) return 0;
+	TRACE_SCOPE("LoadSettings");
 
 	if (createIniDir)
 	{
@@ -939,6 +950,7 @@ int LoadSettings(int force, wchar_t *file) {
 	if (config.debug) {
 		CreateDirectory(L"logs", 0);
 	}
+	LogConfigure(config.debug);
 
 
 	for (int port = 0; port < NumberOfPads; port++) {
@@ -1066,6 +1078,21 @@ int LoadSettings(int force, wchar_t *file) {
 			}
 		}
 	}
+	ClearCombos();
+	for (int i = 0; i < 100; i++) {
+		wchar_t temp[50], temp2[1000];
+		wsprintfW(temp, L"Combo %i", i);
+		if (!GetPrivateProfileStringW(L"Combos", temp, 0, temp2, 1000, file)) continue;
+		Combo combo;
+		int devices[COMBO_MAX_INPUTS];
+		if (!ParseCombo(temp2, &combo, devices)) continue;
+		for (int j = 0; j < combo.numInputs; j++) {
+			wsprintfW(temp, L"Device %i", devices[j]);
+			GetPrivateProfileStringW(temp, L"Instance ID", 0, temp2, 1000, file);
+			combo.inputs[j].instanceID = wcsdup(temp2);
+		}
+		AddCombo(&combo);
+	}
 	config.multipleBinding = multipleBinding;
 
 	RefreshEnabledDevicesAndDisplay(1);
@@ -1138,6 +1165,7 @@ void DeleteBinding(int port, int slot, Device *dev, Binding *b) {
 	int i = b - bindings;
 	memmove(bindings + i, bindings + i + 1, sizeof(Binding) * (dev->pads[port][slot].numBindings - i - 1));
 	dev->pads[port][slot].numBindings--;
+	bindingGeneration++;
 }
 
 void DeleteBinding(int port, int slot, Device *dev, ForceFeedbackBinding *b) {
@@ -1269,6 +1297,7 @@ int BindCommand(Device *dev, unsigned int uid, unsigned int port, unsigned int s
 	b->sensitivity = sensitivity;
 	b->deadZone = deadZone;
 	b->Exponent = exponent;
+	bindingGeneration++;
 	// Where it appears in listview.
 	int count = ListBoundCommand(port, slot, dev, b);
 
@@ -2116,6 +2145,7 @@ INT_PTR CALLBACK GeneralDialogProc(HWND hWnd, unsigned int msg, WPARAM wParam, L
 						memset(&dm->devices[i]->pads[port1][slot1], 0, sizeof(dm->devices[i]->pads[port1][slot1]));
 					}
 				}
+				bindingGeneration++;
 				UpdatePadPages();
 				UpdatePadList(hWnd);
 				PropSheet_Changed(hWndProp, hWnd);
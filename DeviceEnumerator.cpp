@@ -19,6 +19,8 @@
 #include "InputManager.h"
 
 #include "DeviceEnumerator.h"
+#include "Stats.h"
+#include "Trace.h"
 #include "WindowsMessaging.h"
 #include "DirectInput.h"
 #include "KeyboardHook.h"
@@ -32,7 +34,58 @@
 #include "Linux/JoyEvdev.h"
 #endif
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static std::mutex pendingLock;
+static std::vector<Device*> pendingDevices;
+static std::atomic<bool> pendingAny(false);
+static std::atomic<bool> enumCancel(false);
+static std::thread enumThread;
+
+void QueueEnumeratedDevice(Device *dev) {
+	std::lock_guard<std::mutex> lock(pendingLock);
+	pendingDevices.push_back(dev);
+	pendingAny = true;
+}
+
+void AttachEnumeratedDevices() {
+	// Called every frame, so don't even lock unless there's something there.
+	if (!pendingAny) return;
+	std::lock_guard<std::mutex> lock(pendingLock);
+	for (size_t i = 0; i < pendingDevices.size(); i++) {
+		int index = dm->AttachDevice(pendingDevices[i]);
+		// Everything's enabled on Linux, see RefreshEnabledDevices().
+		dm->EnableDevice(index);
+	}
+	pendingDevices.clear();
+	pendingAny = false;
+}
+
+bool EnumerationCancelled() {
+	return enumCancel;
+}
+
+void StopEnumeration() {
+	if (enumThread.joinable()) {
+		enumCancel = true;
+		enumThread.join();
+		enumCancel = false;
+	}
+	std::lock_guard<std::mutex> lock(pendingLock);
+	for (size_t i = 0; i < pendingDevices.size(); i++)
+		delete pendingDevices[i];
+	pendingDevices.clear();
+	pendingAny = false;
+}
+
 void EnumDevices(int hideDXXinput) {
+	TRACE_SCOPE("EnumDevices");
+	// Anything still being probed belongs to the old device list.
+	StopEnumeration();
+	CountStat(STAT_ENUMERATIONS);
+
 	// Needed for enumeration of some device types.
 	dm->ReleaseInput();
 	InputDeviceManager *oldDm = dm;
@@ -47,10 +100,16 @@ void EnumDevices(int hideDXXinput) {
 	EnumDirectInputDevices(hideDXXinput);
 #else
 	EnumLnx();
-	EnumJoystickEvdev();
 #endif
 
 	dm->CopyBindings(oldDm->numDevices, oldDm->devices);
 
+#ifdef __linux__
+	// Opening and querying every node under /dev/input is slow, so it's done
+	// in the background.  Bound devices start out detached and get swapped
+	// in by AttachEnumeratedDevices() as they're found.
+	enumThread = std::thread(EnumJoystickEvdev);
+#endif
+
 	delete oldDm;
 }
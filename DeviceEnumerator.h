@@ -17,3 +17,16 @@
 
 void EnumDevices(int hideDXXinput);
 
+
+class Device;
+
+// Devices probed in the background are queued with QueueEnumeratedDevice(),
+// and handed to dm by AttachEnumeratedDevices(), which must be called with
+// updateLock held.
+void QueueEnumeratedDevice(Device *dev);
+void AttachEnumeratedDevices();
+// Probes should check this between devices, so StopEnumeration() returns quickly.
+bool EnumerationCancelled();
+// Waits for any background probing to finish and throws away anything not
+// yet attached.
+void StopEnumeration();
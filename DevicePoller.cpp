@@ -0,0 +1,206 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "InputManager.h"
+#include "DevicePoller.h"
+#include "Log.h"
+#include "Stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+struct DevicePoller {
+	Device *dev;
+	std::thread thread;
+	// Set before the worker's allowed to start, and never changed.
+	std::thread::id workerId;
+	// Held by the worker during Update(), and by the update thread while it
+	// touches anything Update() does.
+	std::mutex lock;
+	std::condition_variable wake;
+	bool quit;
+	// New state since the last CollectPolled(), and when it was read.
+	bool fresh;
+	u64 eventTime;
+	// Set if FreeState() was left for StopPolling().
+	bool freeState;
+	std::atomic<bool> stopped;
+	// Set by the worker once it's done with everything, lock included.
+	std::atomic<bool> exited;
+	int strikes;
+	// Poll interval while quarantined, 0 otherwise.
+	u32 quarantineMs;
+	// Effects the update thread couldn't set because the worker was busy,
+	// as 0x100 | force.
+	std::atomic<bool> effectsPending;
+	std::atomic<u32> effects[2][4][2];
+
+	DevicePoller(Device *dev) : dev(dev), quit(0), fresh(0), eventTime(0), freeState(0), stopped(false),
+		exited(false), strikes(0), quarantineMs(0), effectsPending(false) {
+		for (int port = 0; port < 2; port++)
+			for (int slot = 0; slot < 4; slot++)
+				for (int motor = 0; motor < 2; motor++)
+					effects[port][slot][motor].store(0, std::memory_order_relaxed);
+	}
+};
+
+// Called with the lock held.
+static void ApplyPendingEffects(DevicePoller *p) {
+	if (!p->effectsPending.exchange(false)) return;
+	for (int port = 0; port < 2; port++) {
+		for (int slot = 0; slot < 4; slot++) {
+			for (int motor = 0; motor < 2; motor++) {
+				u32 effect = p->effects[port][slot][motor].exchange(0);
+				if (effect) p->dev->SetEffects(port, slot, motor, (unsigned char)effect);
+			}
+		}
+	}
+}
+
+static void LogQuarantine(Device *dev, const char *what, u64 us) {
+	if (!LogEnabled(LOGCAT_GENERAL, LOGLEVEL_INFO)) return;
+	char name[64];
+	snprintf(name, sizeof(name), "%ls", dev->displayName);
+	LOG(LOGCAT_GENERAL, LOGLEVEL_INFO, "%s %s, Update() took %llu us\n", name, what, us);
+}
+
+static void PollerThread(DevicePoller *p) {
+	Device *dev = p->dev;
+	// Blocks until StartPolling() has finished setting things up.
+	std::unique_lock<std::mutex> lock(p->lock);
+	u32 periodUs = 1000000 / dev->pollHz;
+	while (!p->quit) {
+		u64 start = MonotonicUs();
+		int updated = dev->Update();
+		u64 now = MonotonicUs();
+		u64 elapsed = now - start;
+		dev->CountUpdate(elapsed);
+		if (!dev->active) {
+			p->stopped = true;
+			break;
+		}
+		if (updated) {
+			p->fresh = 1;
+			p->eventTime = now;
+		}
+		ApplyPendingEffects(p);
+
+		if (elapsed > POLL_BUDGET_US) {
+			if (p->quarantineMs) {
+				p->quarantineMs *= 2;
+				if (p->quarantineMs > POLL_QUARANTINE_MAX_MS) p->quarantineMs = POLL_QUARANTINE_MAX_MS;
+			}
+			else if (++p->strikes >= POLL_STRIKES) {
+				p->quarantineMs = POLL_QUARANTINE_MS;
+				CountStat(STAT_POLL_QUARANTINES);
+				LogQuarantine(dev, "quarantined", elapsed);
+			}
+		}
+		else {
+			if (p->quarantineMs) LogQuarantine(dev, "released from quarantine", elapsed);
+			p->strikes = 0;
+			p->quarantineMs = 0;
+		}
+
+		u64 waitUs = p->quarantineMs ? p->quarantineMs * 1000ull : elapsed < periodUs ? periodUs - elapsed : 0;
+		p->wake.wait_for(lock, std::chrono::microseconds(waitUs), [p] { return p->quit; });
+	}
+	lock.unlock();
+	p->exited = true;
+}
+
+// Only set and read on the thread running DllMain.
+static bool unloading = false;
+
+void SetPollingUnloading() {
+	unloading = true;
+}
+
+void StartPolling(Device *dev) {
+	if (dev->poller || !dev->pollHz || !dev->active) return;
+	DevicePoller *p = new DevicePoller(dev);
+	// Held until everything the worker and DeferFreeState() read is set.
+	std::lock_guard<std::mutex> lock(p->lock);
+	p->thread = std::thread(PollerThread, p);
+	p->workerId = p->thread.get_id();
+	dev->poller = p;
+}
+
+void StopPolling(Device *dev) {
+	DevicePoller *p = dev->poller;
+	if (!p) return;
+	{
+		std::lock_guard<std::mutex> lock(p->lock);
+		p->quit = 1;
+	}
+	p->wake.notify_one();
+	if (unloading) {
+		// Can't join with the loader lock held.  Wait for the worker to be
+		// done with p instead, and let it exit after DllMain.  If it's stuck
+		// in Update(), leak p rather than free it out from under it.
+		for (int i = 0; i < 200 && !p->exited; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		p->thread.detach();
+		dev->poller = 0;
+		if (!p->exited) return;
+	}
+	else {
+		p->thread.join();
+		dev->poller = 0;
+	}
+	if (p->freeState) dev->FreeState();
+	delete p;
+}
+
+bool PollingStopped(Device *dev) {
+	return dev->poller && dev->poller->stopped;
+}
+
+int CollectPolled(Device *dev, u64 *eventTime) {
+	DevicePoller *p = dev->poller;
+	std::unique_lock<std::mutex> lock(p->lock, std::try_to_lock);
+	if (!lock.owns_lock() || p->stopped) return 0;
+	ApplyPendingEffects(p);
+	if (!p->fresh) return 0;
+	p->fresh = 0;
+	*eventTime = p->eventTime;
+	dev->CalcVirtualState();
+	return 1;
+}
+
+void SetPolledEffects(Device *dev, unsigned char port, unsigned int slot, unsigned char motor, unsigned char force) {
+	DevicePoller *p = dev->poller;
+	std::unique_lock<std::mutex> lock(p->lock, std::try_to_lock);
+	if (lock.owns_lock()) {
+		ApplyPendingEffects(p);
+		dev->SetEffects(port, slot, motor, force);
+		return;
+	}
+	p->effects[port][slot][motor] = 0x100 | force;
+	p->effectsPending = true;
+}
+
+bool DeferFreeState(Device *dev) {
+	DevicePoller *p = dev->poller;
+	if (!p || p->workerId != std::this_thread::get_id()) return false;
+	p->freeState = 1;
+	return true;
+}
@@ -0,0 +1,67 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Devices that have to be asked for their state, rather than being handed
+// input, each get a worker thread that calls Update() at the device's own
+// report rate (Device::pollHz).  A slow or hung device then only holds up
+// its own input, not everyone else's.
+//
+// The worker holds the poller's lock while in Update(), and sleeps with it
+// released.  The update thread only ever tries the lock, so if a worker's
+// busy, its device just keeps last frame's state.
+//
+// A device whose Update() runs over POLL_BUDGET_US POLL_STRIKES times in a
+// row is quarantined, and polled every POLL_QUARANTINE_MS, doubling up to
+// POLL_QUARANTINE_MAX_MS, until an Update() comes in under budget.
+//
+// Not used while binding, which wants every device read right away.
+
+#define POLL_BUDGET_US 2000
+#define POLL_STRIKES 3
+#define POLL_QUARANTINE_MS 250
+#define POLL_QUARANTINE_MAX_MS 4000
+
+class Device;
+
+// Starts a worker for an active device with a pollHz.  Does nothing if
+// there's already one.
+void StartPolling(Device *dev);
+// Stops the worker, so the device can be deactivated or deleted.  Waits for
+// any Update() in progress.  Does nothing if the device isn't polled.
+void StopPolling(Device *dev);
+// For DllMain, which holds the loader lock threads need to exit.  From then
+// on StopPolling() waits for the worker to finish its loop and detaches it,
+// rather than joining it.
+void SetPollingUnloading();
+// True once the device has deactivated itself, on its worker.
+bool PollingStopped(Device *dev);
+
+// If the worker has read new state since the last call and isn't in
+// Update(), runs CalcVirtualState() on it and returns 1, with eventTime
+// set to when it was read.  Otherwise returns 0.
+int CollectPolled(Device *dev, u64 *eventTime);
+// Calls SetEffects() now if the worker's idle, otherwise leaves it for the
+// worker to do after its Update().
+void SetPolledEffects(Device *dev, unsigned char port, unsigned int slot, unsigned char motor, unsigned char force);
+
+// For FreeState().  When a device deactivates itself on its worker, the
+// update thread may still be reading its state, so that's left for
+// StopPolling() to free.  Returns true if it's been left.
+bool DeferFreeState(Device *dev);
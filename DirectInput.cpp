@@ -59,8 +59,11 @@ struct DirectInput8Data {
 };
 
 DirectInput8Data di8d = {0,0,0};
+// Polled devices can release it from their worker threads.
+static std::mutex di8Lock;
 
 IDirectInput8* GetDirectInput() {
+	std::lock_guard<std::mutex> lock(di8Lock);
 	if (!di8d.lpDI8) {
 		if (FAILED(DirectInput8Create(hInst, 0x800, IID_IDirectInput8, (void**) &di8d.lpDI8, 0))) return 0;
 	}
@@ -68,6 +71,7 @@ IDirectInput8* GetDirectInput() {
 	return di8d.lpDI8;
 }
 void ReleaseDirectInput() {
+	std::lock_guard<std::mutex> lock(di8Lock);
 	if (di8d.refCount) {
 		di8d.refCount--;
 		if (!di8d.refCount) {
@@ -116,6 +120,8 @@ public:
 		diEffects = 0;
 		guidInstance = guid;
 		this->did = 0;
+		// Keyboards and mice stay on the update thread.
+		if (type == OTHER) pollHz = 125;
 		did->EnumEffects(EnumEffectsCallback, this, DIEFT_ALL);
 		did->EnumObjects(EnumDeviceObjectsCallback, this, DIDFT_ALL);
 		did->Release();
@@ -20,6 +20,7 @@
 
 #include "usb.h"
 #include "HidDevice.h"
+#include "Stats.h"
 
 
 #define VID 0x054c
@@ -40,6 +41,8 @@
 
 unsigned int lastDS3Check = 0;
 unsigned int lastDS3Enum = 0;
+// Each pad checks from its own poller thread.
+static std::mutex ds3CheckLock;
 
 typedef void (__cdecl *_usb_init)(void);
 typedef int (__cdecl *_usb_close)(usb_dev_handle *dev);
@@ -185,6 +188,8 @@ int CharToButton(unsigned char c) {
 	return (v * FULLY_DOWN)>>8;
 }
 
+static DeviceLayout dualShock4Layout;
+
 class DualShock4Device : public Device {
 	// Cached last vibration values by pad and motor.
 	// Need this, as only one value is changed at a time.
@@ -237,6 +242,7 @@ public:
 			}
 
 			writeCount++;
+			CountStat(STAT_FF_WRITES);
 			int res = WriteFile(hFile, &sendState, sizeof(sendState), 0, &writeop);
 			return (res || GetLastError() == ERROR_IO_PENDING);
 		}
@@ -259,6 +265,9 @@ public:
 		memset(ps2Vibration, 0, sizeof(ps2Vibration));
 		vibration[0] = vibration[1] = 0;
 		this->index = index;
+		hFile = INVALID_HANDLE_VALUE;
+		pollHz = 250;
+		if (UseLayout(&dualShock4Layout)) return;
 		int i;
 		for (i=0; i<16; i++) {
 			if (i != 14 && i != 15 && i != 8 && i != 9) {
@@ -274,7 +283,7 @@ public:
 		AddFFAxis(L"Big Motor", 0);
 		AddFFAxis(L"Small Motor", 1);
 		AddFFEffectType(L"Constant Effect", L"Constant", EFFECT_CONSTANT);
-		hFile = INVALID_HANDLE_VALUE;
+		SaveLayout(&dualShock4Layout);
 	}
 
 	wchar_t *GetPhysicalControlName(PhysicalControl *c) {
@@ -383,6 +392,7 @@ public:
 			}
 			else {
 				if (time-dataLastReceived >= DEVICE_CHECK_DELAY) {
+					std::lock_guard<std::mutex> lock(ds3CheckLock);
 					if (time-dataLastReceived >= DEVICE_ENUM_DELAY) {
 						DS4Enum(time);
 					}
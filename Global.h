@@ -174,6 +174,12 @@ typedef struct {
 	bool btnUpdate, axisLXUpdate, axisLYUpdate, axisRXUpdate, axisRYUpdate;
 } RPPadDataS;
 
+// Parts of RPPadDataS, for PADsetOutputs.
+#define RP_OUTPUT_BUTTONS 1
+#define RP_OUTPUT_LEFT_STICK 2
+#define RP_OUTPUT_RIGHT_STICK 4
+#define RP_OUTPUT_ALL 7
+
 EXPORT_C_(void) PADupdate(int pad);
 EXPORT_C_(u32) PS2EgetLibType(void);
 EXPORT_C_(u32) PS2EgetLibVersion2(u32 type);
@@ -191,6 +197,19 @@ EXPORT_C_(s32) PADtest();
 EXPORT_C_(keyEvent*) PADkeyEvent();
 EXPORT_C_(u32) PADreadPort1(RPPadDataS* RPpad);
 EXPORT_C_(u32) PADreadPort2(RPPadDataS* RPpad);
+// Like PADreadPort1, but evaluates every enabled pad from a single read of
+// the devices.  RPpads needs 8 entries, indexed by port * 4 + slot.  Bit
+// port * 4 + slot of updated is set for each pad written.  updated may be
+// NULL.
+EXPORT_C_(u32) PADreadAllPorts(RPPadDataS* RPpads, u32 *updated);
+// Which RP_OUTPUT_ parts of a pad's RPPadDataS the host reads.  Bindings
+// for the rest aren't evaluated.  All of them, by default.
+EXPORT_C_(void) PADsetOutputs(u8 port, u8 slot, u32 outputs);
+// Input latency histograms as text.  Returns the full length, which may be
+// more than size, like snprintf.
+EXPORT_C_(u32) PADgetLatencyStats(char *out, u32 size);
+// Throughput and health counters as text, same conventions as above.
+EXPORT_C_(u32) PADgetStats(char *out, u32 size);
 EXPORT_C_(u32) PSEgetLibType();
 EXPORT_C_(u32) PSEgetLibVersion();
 EXPORT_C_(void) PADconfigure();
@@ -254,3 +273,16 @@ inline int __cdecl wcsicmp(const wchar_t *s1, const wchar_t *s2) {
 }
 
 #endif
+
+#ifdef LILYPAD_ALLOC_STATS
+// Counts heap allocations per thread, so the update path can check it has
+// stopped allocating once devices are set up.  See CheckFrameAllocations().
+// Stats.cpp replaces new and delete to count those too.
+void * CountedMalloc(size_t size);
+void * CountedCalloc(size_t num, size_t size);
+void * CountedRealloc(void *mem, size_t size);
+
+#define malloc(size) CountedMalloc(size)
+#define calloc(num, size) CountedCalloc(num, size)
+#define realloc(mem, size) CountedRealloc(mem, size)
+#endif
@@ -16,8 +16,15 @@
  */
 
 #include "Global.h"
+#include <assert.h>
 #include "InputManager.h"
+#include "DevicePoller.h"
 #include "KeyboardQueue.h"
+#include "Stats.h"
+#include "Trace.h"
+
+unsigned int bindingGeneration = 1;
+unsigned int deviceGeneration = 1;
 
 InputDeviceManager *dm = 0;
 
@@ -27,11 +34,13 @@ InputDeviceManager::InputDeviceManager() {
 
 void InputDeviceManager::ClearDevices() {
 	for (int i = 0; i < numDevices; i++) {
+		StopPolling(devices[i]);
 		delete devices[i];
 	}
 	free(devices);
 	devices = 0;
 	numDevices = 0;
+	deviceGeneration++;
 }
 
 InputDeviceManager::~InputDeviceManager() {
@@ -40,6 +49,9 @@ InputDeviceManager::~InputDeviceManager() {
 
 Device::Device(DeviceAPI api, DeviceType d, const wchar_t *displayName, const wchar_t *instanceID, wchar_t *productID) {
 	memset(pads, 0, sizeof(pads));
+	memset(digital, 0, sizeof(digital));
+	memset(plans, 0, sizeof(plans));
+	memset(sticks, 0, sizeof(sticks));
 	this->api = api;
 	type = d;
 	this->displayName = wcsdup(displayName);
@@ -66,6 +78,7 @@ Device::Device(DeviceAPI api, DeviceType d, const wchar_t *displayName, const wc
 	physicalControls = 0;
 	numPhysicalControls = 0;
 	physicalControlState = 0;
+	changedControls = 0;
 
 	ffEffectTypes = 0;
 	numFFEffectTypes = 0;
@@ -73,11 +86,18 @@ Device::Device(DeviceAPI api, DeviceType d, const wchar_t *displayName, const wc
 	numFFAxes = 0;
 }
 
+void Device::SetMouse() {
+	isMouse = true;
+	if (!mc) mc = (s_mouse_control*)calloc(1, sizeof(s_mouse_control));
+}
+
 void Device::FreeState() {
+	if (DeferFreeState(this)) return;
 	if (virtualControlState) free(virtualControlState);
 	virtualControlState = 0;
 	oldVirtualControlState = 0;
 	physicalControlState = 0;
+	sampledControlState = 0;
 }
 
 Device::~Device() {
@@ -92,8 +112,24 @@ Device::~Device() {
 				free(pads[port][slot].ffBindings[i].axes);
 			}
 			free(pads[port][slot].ffBindings);
+			free(digital[port][slot].keys);
+			free(digital[port][slot].masks);
+			free(digital[port][slot].turboMasks);
+			free(plans[port][slot].bindings);
+			if (sticks[port][slot]) {
+				free(sticks[port][slot]->inputs);
+				free(sticks[port][slot]);
+			}
 		}
 	}
+	free(mc);
+	free(changedControls);
+	free(displayName);
+	free(instanceID);
+	free(productID);
+	free(latency);
+	if (layout) return;
+
 	free(virtualControls);
 
 	for (i = numPhysicalControls - 1; i >= 0; i--) {
@@ -101,9 +137,6 @@ Device::~Device() {
 	}
 	free(physicalControls);
 
-	free(displayName);
-	free(instanceID);
-	free(productID);
 	if (ffAxes) {
 		for (i = 0; i < numFFAxes; i++) {
 			free(ffAxes[i].displayName);
@@ -120,6 +153,7 @@ Device::~Device() {
 }
 
 void Device::AddFFEffectType(const wchar_t *displayName, const wchar_t *effectID, EffectType type) {
+	assert(!layout);
 	ffEffectTypes = (ForceFeedbackEffectType*)realloc(ffEffectTypes, sizeof(ForceFeedbackEffectType) * (numFFEffectTypes + 1));
 	ffEffectTypes[numFFEffectTypes].displayName = wcsdup(displayName);
 	ffEffectTypes[numFFEffectTypes].effectID = wcsdup(effectID);
@@ -128,6 +162,7 @@ void Device::AddFFEffectType(const wchar_t *displayName, const wchar_t *effectID
 }
 
 void Device::AddFFAxis(const wchar_t *displayName, int id) {
+	assert(!layout);
 	ffAxes = (ForceFeedbackAxis*)realloc(ffAxes, sizeof(ForceFeedbackAxis) * (numFFAxes + 1));
 	ffAxes[numFFAxes].id = id;
 	ffAxes[numFFAxes].displayName = wcsdup(displayName);
@@ -157,16 +192,76 @@ void Device::AddFFAxis(const wchar_t *displayName, int id) {
 
 void Device::AllocState() {
 	FreeState();
-	virtualControlState = (int*)calloc((numVirtualControls* 2) + numPhysicalControls, sizeof(int));
+	virtualControlState = (int*)calloc((numVirtualControls* 3) + numPhysicalControls, sizeof(int));
 	oldVirtualControlState = virtualControlState + numVirtualControls;
 	//oldVirtualControlStatebuff = oldVirtualControlState + numVirtualControls;
 	physicalControlState = oldVirtualControlState + numVirtualControls;
+	sampledControlState = physicalControlState + numPhysicalControls;
+	if (changedControls) MarkAllChanged();
+}
+
+void Device::StampInput(u64 eventTime) {
+	// Only the oldest pending change matters.
+	if (inputReadTime) return;
+	u64 now = MonotonicUs();
+	// Anything in the future or implausibly old is on some other clock.
+	if (!eventTime || eventTime > now || now - eventTime > 10000000)
+		eventTime = now;
+	inputEventTime = eventTime;
+	inputReadTime = now;
+}
+
+// Calls f(index) for every control marked in bits, then every bound one.
+// Bound ones have to be included because UpdateRP writes scaled values back
+// over their virtual state.
+template <typename F>
+static void ForSparseControls(Device *dev, u32 *bits, F f) {
+	int words = (dev->numPhysicalControls + 31) >> 5;
+	for (int w = 0; w < words; w++) {
+		u32 word = bits[w];
+		while (word) {
+			int bit = 0;
+			while (!(word & (1u << bit))) bit++;
+			word &= word - 1;
+			f((w << 5) + bit);
+		}
+	}
+	for (int port = 0; port < 2; port++) {
+		for (int slot = 0; slot < 4; slot++) {
+			PadBindings *p = &dev->pads[port][slot];
+			for (int i = 0; i < p->numBindings; i++) {
+				int index = p->bindings[i].controlIndex;
+				if (index < dev->numPhysicalControls) f(index);
+			}
+		}
+	}
+}
+
+void Device::EnableSparseState() {
+	assert(layout && layout->numLeadingButtons == numPhysicalControls);
+	changedControls = (u32*)calloc(2 * ((numPhysicalControls + 31) >> 5), sizeof(u32));
+}
+
+void Device::MarkAllChanged() {
+	int words = (numPhysicalControls + 31) >> 5;
+	memset(changedControls, 0xFF, words * sizeof(u32));
+	if (numPhysicalControls & 31)
+		changedControls[words - 1] = (1u << (numPhysicalControls & 31)) - 1;
 }
 
 void Device::FlipState() {
-	if (oldVirtualControlState && virtualControlState)
+	if (!oldVirtualControlState || !virtualControlState) return;
+	if (changedControls) {
+		int words = (numPhysicalControls + 31) >> 5;
+		u32 *recalculated = changedControls + words;
+		int *state = virtualControlState;
+		int *old = oldVirtualControlState;
+		ForSparseControls(this, recalculated, [=](int i) { old[i] = state[i]; });
+		memset(recalculated, 0, words * sizeof(u32));
+		return;
+	}
 	//memcpy(oldVirtualControlStatebuff, oldVirtualControlState, sizeof(int)*numVirtualControls);
-		memcpy(oldVirtualControlState, virtualControlState, sizeof(int)*numVirtualControls);
+	memcpy(oldVirtualControlState, virtualControlState, sizeof(int)*numVirtualControls);
 }
 
 void Device::PostRead() {
@@ -186,7 +281,10 @@ void Device::PostRead() {
 
 
 
+static LockSite motionLockSite("Device::m_mutex process_motion");
+
 void Device::process_motion(s_mouse_control* mc){
+	TRACE_SCOPE("Device::process_motion");
 	int i, k;
 	unsigned int j;
 	int weight;
@@ -196,7 +294,7 @@ void Device::process_motion(s_mouse_control* mc){
 	*/
 	if (mc->changed || mc->change)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
+		ProfiledLock<std::mutex> lock(motionLockSite, m_mutex);
 
 		mc->merge_x[mc->index] = mc->mousex;
 		mc->merge_y[mc->index] = mc->mousey;
@@ -260,7 +358,26 @@ void Device::process_motion(s_mouse_control* mc){
 }
 
 void Device::CalcVirtualState() {
-	for (int i = 0; i < numPhysicalControls; i++) {
+	TRACE_SCOPE("Device::CalcVirtualState");
+	if (changedControls) {
+		int words = (numPhysicalControls + 31) >> 5;
+		u32 *recalculated = changedControls + words;
+		int *state = virtualControlState;
+		int *physical = physicalControlState;
+		ForSparseControls(this, changedControls, [=](int i) { state[i] = physical[i]; });
+		for (int w = 0; w < words; w++) {
+			recalculated[w] |= changedControls[w];
+			changedControls[w] = 0;
+		}
+		return;
+	}
+	int i = 0;
+	// Known to be plain buttons, so nothing to split.
+	if (layout) {
+		i = layout->numLeadingButtons;
+		memcpy(virtualControlState, physicalControlState, i * sizeof(int));
+	}
+	for (; i < numPhysicalControls; i++) {
 		PhysicalControl *c = physicalControls + i;
 		int index = c->baseVirtualControlIndex;
 		int val = physicalControlState[i];
@@ -298,7 +415,7 @@ void Device::CalcVirtualState() {
 		else if (c->type & RELAXIS) {
 			if (isMouse){ // Need to smooth out the mouse input
 				//Output("Processing %d\n", c->baseVirtualControlIndex);
-				process_motion(&mc);
+				process_motion(mc);
 
 				//int val = mouse2axis(0, &mc, mc.x, mc.y, 0.8, 15, 0, E_SHAPE_CIRCLE, E_MOUSE_MODE_AIMING);
 
@@ -310,7 +427,7 @@ void Device::CalcVirtualState() {
 				//virtualControlState[index + 2] = (-delta & (delta >> 31));
 				//Output("X: %d\n", val);
 
-				val = mc.x;
+				val = mc->x;
 				virtualControlState[index] = val;
 				// Positive
 				virtualControlState[index + 1] = (val & ~(val >> 31));
@@ -321,7 +438,7 @@ void Device::CalcVirtualState() {
 				c = physicalControls + i;
 				index = c->baseVirtualControlIndex;
 
-				val = mc.y;
+				val = mc->y;
 				virtualControlState[index] = val;
 				// Positive
 				virtualControlState[index + 1] = (val & ~(val >> 31));
@@ -420,6 +537,7 @@ VirtualControl *Device::GetVirtualControl(unsigned int uid) {
 }
 
 VirtualControl *Device::AddVirtualControl(unsigned int uid, int physicalControlIndex) {
+	assert(!layout);
 	// Not really necessary, as always call AllocState when activated, but doesn't hurt.
 	FreeState();
 
@@ -436,6 +554,7 @@ VirtualControl *Device::AddVirtualControl(unsigned int uid, int physicalControlI
 }
 
 PhysicalControl *Device::AddPhysicalControl(ControlType type, unsigned short id, unsigned short vkey, const wchar_t *name) {
+	assert(!layout);
 	// Not really necessary, as always call AllocState when activated, but doesn't hurt.
 	FreeState();
 
@@ -470,6 +589,36 @@ PhysicalControl *Device::AddPhysicalControl(ControlType type, unsigned short id,
 	return control;
 }
 
+int Device::UseLayout(const DeviceLayout *layout) {
+	if (!layout->physicalControls) return 0;
+	this->layout = layout;
+	physicalControls = layout->physicalControls;
+	numPhysicalControls = layout->numPhysicalControls;
+	virtualControls = layout->virtualControls;
+	numVirtualControls = layout->numVirtualControls;
+	ffEffectTypes = layout->ffEffectTypes;
+	numFFEffectTypes = layout->numFFEffectTypes;
+	ffAxes = layout->ffAxes;
+	numFFAxes = layout->numFFAxes;
+	return 1;
+}
+
+void Device::SaveLayout(DeviceLayout *layout) {
+	layout->physicalControls = physicalControls;
+	layout->numPhysicalControls = numPhysicalControls;
+	layout->virtualControls = virtualControls;
+	layout->numVirtualControls = numVirtualControls;
+	layout->ffEffectTypes = ffEffectTypes;
+	layout->numFFEffectTypes = numFFEffectTypes;
+	layout->ffAxes = ffAxes;
+	layout->numFFAxes = numFFAxes;
+	int i = 0;
+	while (i < numPhysicalControls && (physicalControls[i].type & BUTTON) && physicalControls[i].baseVirtualControlIndex == i)
+		i++;
+	layout->numLeadingButtons = i;
+	this->layout = layout;
+}
+
 void Device::SetEffects(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force) {
 	for (int i = 0; i < pads[port][slot].numFFBindings; i++) {
 		ForceFeedbackBinding *binding = pads[port][slot].ffBindings + i;
@@ -543,18 +692,59 @@ wchar_t *Device::GetPhysicalControlName(PhysicalControl *control) {
 void InputDeviceManager::AddDevice(Device *d) {
 	devices = (Device**)realloc(devices, sizeof(Device*) * (numDevices + 1));
 	devices[numDevices++] = d;
+	deviceGeneration++;
 }
 
 void InputDeviceManager::Update(InitInfo *info) {
+	TRACE_SCOPE("InputDeviceManager::Update");
 	for (int i = 0; i < numDevices; i++) {
+		// Binding reads everything itself.  Otherwise, a device that's
+		// deactivated itself on its worker gets activated again below.
+		if (info->binding || PollingStopped(devices[i]))
+			StopPolling(devices[i]);
 		if (devices[i]->enabled) {
 			if (!devices[i]->active) {
-				if ( !devices[i]->Activate(info) || !devices[i]->Update()) continue;
+				if (!devices[i]->Activate(info)) {
+					CountStat(STAT_ACTIVATE_FAILURES);
+					continue;
+				}
+				// Allocated here rather than on first input, which would be
+				// in the middle of a frame.
+				if (!devices[i]->latency)
+					devices[i]->latency = (LatencyHistogram*)calloc(1, sizeof(LatencyHistogram));
+				if (!devices[i]->Update()) continue;
 				devices[i]->CalcVirtualState();
 				devices[i]->PostRead();
 			}
-			if (devices[i] && devices[i]->Update())
-				devices[i]->CalcVirtualState();
+			Device *dev = devices[i];
+			if (dev->poller) {
+				u64 eventTime;
+				if (CollectPolled(dev, &eventTime)) {
+					dev->StampInput(eventTime);
+					dev->CountInputs(1);
+				}
+				continue;
+			}
+			u64 start = MonotonicUs();
+			int updated;
+			{
+				TRACE_SCOPE("Device::Update");
+				updated = dev->Update();
+			}
+			u64 elapsed = MonotonicUs() - start;
+			dev->CountUpdate(elapsed);
+			if (updated) {
+				dev->CalcVirtualState();
+				// Mice report every frame whether they moved or not, so they
+				// stamp themselves.
+				if (!dev->isMouse) {
+					dev->StampInput(0);
+					if (dev->api != LNX_JOY && dev->api != LNX_EVDEV)
+						dev->CountInputs(1);
+				}
+			}
+			if (dev->pollHz && dev->active && !info->binding)
+				StartPolling(dev);
 		}
 	}
 }
@@ -628,6 +818,7 @@ Device *InputDeviceManager::GetActiveDevice(InitInfo *info, unsigned int *uid, i
 
 void InputDeviceManager::ReleaseInput() {
 	for (int i = 0; i < numDevices; i++) {
+		StopPolling(devices[i]);
 		if (devices[i]->active) devices[i]->Deactivate();
 	}
 }
@@ -648,6 +839,7 @@ void InputDeviceManager::DisableAllDevices() {
 
 void InputDeviceManager::DisableDevice(int index) {
 	devices[index]->enabled = 0;
+	StopPolling(devices[index]);
 	if (devices[index]->active) {
 		devices[index]->Deactivate();
 	}
@@ -780,11 +972,41 @@ void InputDeviceManager::CopyBindings(int numOldDevices, Device **oldDevices) {
 	free(matches);
 }
 
+int InputDeviceManager::AttachDevice(Device *d) {
+	// Same order as CopyBindings, but only against detached devices.
+	for (int id = 0; id < 3; id++) {
+		if (!d->IDs[id]) continue;
+		for (int i = 0; i < numDevices; i++) {
+			Device *old = devices[i];
+			if (old->attached || !old->IDs[id] || wcsicmp(d->IDs[id], old->IDs[id])) continue;
+
+			// Let CopyBindings do the remapping, with d as the only new device.
+			InputDeviceManager temp;
+			temp.AddDevice(d);
+			temp.CopyBindings(1, &old);
+			// d belongs to this now.
+			temp.numDevices = 0;
+
+			devices[i] = d;
+			StopPolling(old);
+			delete old;
+			deviceGeneration++;
+			return i;
+		}
+	}
+	AddDevice(d);
+	return numDevices - 1;
+}
+
 void InputDeviceManager::SetEffect(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force) {
+	TRACE_SCOPE("InputDeviceManager::SetEffect");
 	for (int i = 0; i < numDevices; i++) {
 		Device *dev = devices[i];
 		if (dev->enabled && dev->numFFEffectTypes) {
-			dev->SetEffects(port, slot, motor, force);
+			if (dev->poller)
+				SetPolledEffects(dev, port, slot, motor, force);
+			else
+				dev->SetEffects(port, slot, motor, force);
 		}
 	}
 }
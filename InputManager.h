@@ -18,6 +18,7 @@
 #ifndef INPUT_MANAGER_H
 #define INPUT_MANAGER_H
 
+#include <atomic>
 #include <mutex>
 
 // Both of these are hard coded in a lot of places, so don't modify them.
@@ -168,6 +169,8 @@ enum DeviceAPI {
 	// XXX
 	LNX_KEYBOARD = 16,
 	LNX_JOY = 17,
+	// Keyboards and mice read directly from /dev/input.
+	LNX_EVDEV = 18,
 };
 
 enum DeviceType {
@@ -226,6 +229,88 @@ struct PadBindings {
 	int numFFBindings;
 };
 
+// Which pad buttons each bound key presses, for the plain button bindings
+// of a device that tracks changed controls.  Lets UpdateRP handle all of
+// them with a few ORs instead of a pass per binding.
+struct DigitalMatrix {
+	// Rebuilt when this doesn't match bindingGeneration.
+	unsigned int generation;
+	int numKeys;
+	// One entry per bound key.
+	int *keys;
+	u32 *masks;
+	// Buttons the key presses with turbo on.  Not in masks.
+	u32 *turboMasks;
+	// Buttons the device's keys held last frame.
+	u32 buttons;
+};
+
+// A pad's bindings that are left to UpdateRP's per binding code, grouped by
+// the RP_OUTPUT_ part of RPPadDataS they write, so parts the host doesn't
+// read can be skipped whole.
+#define BINDING_PLAN_CLASSES 3
+
+struct BindingPlan {
+	// Rebuilt when this doesn't match bindingGeneration.
+	unsigned int generation;
+	// Binding indices, buttons first, then left stick, then right stick.
+	int *bindings;
+	// Where each class starts in bindings.  The last entry is the total.
+	int start[BINDING_PLAN_CLASSES + 1];
+};
+
+#define STICK_CURVE_LEN 256
+
+// A pad's analog stick bindings, compiled so UpdateRP can combine each
+// stick's directions and then apply a radial dead zone and response curve,
+// rather than handling each half axis on its own.  Not used for mice, which
+// have their own handling.
+struct StickProcessor {
+	// Rebuilt when this doesn't match bindingGeneration.
+	unsigned int generation;
+	int numInputs;
+	struct StickInput {
+		int controlIndex;
+		// As in Binding.  Negative is flipped.
+		int sensitivity;
+		u8 stick;
+		// 0-3 for up, right, down, left, same order as the commands.
+		u8 direction;
+	} *inputs;
+	// Bit 0 if the stick has X bindings, bit 1 if it has Y ones.
+	u8 axes[2];
+	// Output magnitude, from 0 to 127 in 8.8 fixed point, by input magnitude
+	// in steps of FULLY_DOWN/STICK_CURVE_LEN.  Dead zone and exponent are
+	// baked in.
+	u16 curve[2][STICK_CURVE_LEN + 1];
+};
+
+// Bumped by anything that adds, removes or edits bindings.
+extern unsigned int bindingGeneration;
+// Bumped whenever a device is added to or removed from any
+// InputDeviceManager, so anything holding Device pointers knows to look
+// them up again.
+extern unsigned int deviceGeneration;
+
+// Controls and force feedback tables for a device class whose layout never
+// changes.  The first device of the class builds it with the usual Add*()
+// calls and hands it over with SaveLayout(), after which every device of
+// that class shares it, read only, and constructs without allocating.
+// Devices are only created with fixed layouts on the enumerating thread.
+struct DeviceLayout {
+	PhysicalControl *physicalControls;
+	int numPhysicalControls;
+	VirtualControl *virtualControls;
+	int numVirtualControls;
+	ForceFeedbackEffectType *ffEffectTypes;
+	int numFFEffectTypes;
+	ForceFeedbackAxis *ffAxes;
+	int numFFAxes;
+	// Number of leading physical controls that are buttons.  Those map one to
+	// one onto the first virtual controls.
+	int numLeadingButtons;
+};
+
 class WndProcEater;
 
 struct InitInfo {
@@ -253,13 +338,82 @@ struct InitInfo {
 // updating the ListView simpler.
 class Device {
 public:
-	DeviceAPI api;
-	DeviceType type;
-	char active;
+	// Everything the per-frame update and binding loops touch comes first, so
+	// it spans as few cache lines as possible.  Names, force feedback tables
+	// and the like, only needed when binding or setting effects, come after.
+	// Polled devices can deactivate themselves on their worker while the
+	// update thread's reading this, so it's atomic.
+	std::atomic<char> active;
 	char attached;
 	// Based on input modes.
 	char enabled;
 	bool isMouse = false;
+	DeviceAPI api;
+	DeviceType type;
+
+	int *virtualControlState;
+	int *oldVirtualControlState;
+	int *oldVirtualControlStatebuff;
+	int *physicalControlState;
+	// virtualControlState as it was read, for evaluating several pads from
+	// one read.  Bindings write scaled values over the original.  Allocated
+	// with the rest of the state, so it's there whenever that is.
+	int *sampledControlState = 0;
+
+	// Virtual controls.  All basically act like pressure sensitivity buttons, with
+	// values between 0 and 2^16.  2^16 is fully down, 0 is up.  Larger values
+	// are allowed, but *only* for absolute axes (Which don't support the flip checkbox).
+	// Each control on a device must have a unique id, used for binding.
+	VirtualControl *virtualControls;
+	int numVirtualControls;
+
+	PhysicalControl *physicalControls;
+	int numPhysicalControls;
+
+	// Keyboards only see a few of their hundreds of keys change each frame,
+	// and only a handful are bound.  For them, this is two bitsets with a bit
+	// per physical control: ones SetButtonState() changed, for
+	// CalcVirtualState(), then ones it recalculated, for FlipState().  Those
+	// two only touch the marked controls and bound ones.  0 otherwise.
+	u32 *changedControls;
+
+	PadBindings pads[2][4];
+
+	// When the oldest change the host hasn't seen yet happened, and when it was
+	// read, in MonotonicUs() time.  inputReadTime is 0 when nothing's pending.
+	// Only touched from the thread that updates devices.
+	u64 inputEventTime = 0;
+	u64 inputReadTime = 0;
+
+	// For PADgetStats.  Inputs are events read for devices that see them, and
+	// updates that found new input for the rest.  Written by whichever thread
+	// updates the device, and read by PADgetStats on another, so relaxed
+	// atomics.
+	std::atomic<u64> statInputs{0};
+	std::atomic<u64> statUpdates{0};
+	std::atomic<u64> statUpdateUs{0};
+	std::atomic<u64> statUpdateMaxUs{0};
+
+	void CountInputs(u64 n) {
+		statInputs.fetch_add(n, std::memory_order_relaxed);
+	}
+	// Only one thread updates a device at a time, so max needs no CAS.
+	void CountUpdate(u64 us) {
+		statUpdates.fetch_add(1, std::memory_order_relaxed);
+		statUpdateUs.fetch_add(us, std::memory_order_relaxed);
+		if (us > statUpdateMaxUs.load(std::memory_order_relaxed))
+			statUpdateMaxUs.store(us, std::memory_order_relaxed);
+	}
+
+	// Report rate of devices that have to be asked for their state.  Those
+	// are updated on a thread of their own, see DevicePoller.h.  0 for the
+	// rest.
+	u32 pollHz = 0;
+	struct DevicePoller *poller = 0;
+
+	// Only allocated for mice, by SetMouse().  Over 4 KB, so not worth
+	// carrying around in every keyboard and pad.
+	s_mouse_control *mc = 0;
 	mutable std::mutex m_mutex;
 
 #ifdef _MSC_VER
@@ -284,22 +438,16 @@ public:
 		};
 	};
 
-	PadBindings pads[2][4];
-
-	// Virtual controls.  All basically act like pressure sensitivity buttons, with
-	// values between 0 and 2^16.  2^16 is fully down, 0 is up.  Larger values
-	// are allowed, but *only* for absolute axes (Which don't support the flip checkbox).
-	// Each control on a device must have a unique id, used for binding.
-	VirtualControl *virtualControls;
-	int numVirtualControls;
+	struct LatencyHistogram *latency = 0;
 
-	int *virtualControlState;
-	int *oldVirtualControlState;
-	int *oldVirtualControlStatebuff;
+	DigitalMatrix digital[2][4];
+	BindingPlan plans[2][4];
+	// Allocated for pads with analog stick bindings.
+	StickProcessor *sticks[2][4];
 
-	PhysicalControl *physicalControls;
-	int numPhysicalControls;
-	int *physicalControlState;
+	// Shared controls and FF tables, if the device has a fixed layout.
+	// Shared tables aren't freed, and can't have anything added to them.
+	const DeviceLayout *layout = 0;
 
 	ForceFeedbackEffectType *ffEffectTypes;
 	int numFFEffectTypes;
@@ -320,6 +468,17 @@ public:
 	// Doesn't actually flip.  Copies current state to old state.
 	void FlipState();
 
+	// Switches to tracking changed controls, as described above.  Needs a
+	// layout that's all buttons, so virtual and physical indices match.
+	void EnableSparseState();
+	inline void SetButtonState(int index, int value) {
+		if ((unsigned int)index >= (unsigned int)numPhysicalControls || physicalControlState[index] == value) return;
+		physicalControlState[index] = value;
+		changedControls[index >> 5] |= 1u << (index & 31);
+	}
+	// For when physicalControlState is written directly.
+	void MarkAllChanged();
+
 	// Frees state variables.
 	void FreeState();
 
@@ -331,10 +490,22 @@ public:
 	PhysicalControl *AddPhysicalControl(ControlType type, unsigned short id, unsigned short vkey, const wchar_t *name = 0);
 	VirtualControl *AddVirtualControl(unsigned int uid, int physicalControlIndex);
 
+	// Returns 1 and uses the layout's tables if it's been saved already.
+	// Otherwise returns 0, and the caller should add its controls then call
+	// SaveLayout().
+	int UseLayout(const DeviceLayout *layout);
+	void SaveLayout(DeviceLayout *layout);
+
 	virtual wchar_t *GetVirtualControlName(VirtualControl *c);
 	virtual wchar_t *GetPhysicalControlName(PhysicalControl *c);
 
-	s_mouse_control mc = {};
+	// Marks the device as a mouse, and sets up motion smoothing for it.
+	// Called by mouse constructors.
+	void SetMouse();
+
+	// Called when new input is read.  eventTime is when it happened, if the
+	// device knows, otherwise 0 to use the current time.
+	void StampInput(u64 eventTime);
 
 	void CalcVirtualState();
 	void process_motion(s_mouse_control* mc);
@@ -360,7 +531,7 @@ public:
 	// Note:  Only used externally for binding, so if override the other one, can assume
 	// all other forces are currently 0.
 	inline virtual void SetEffect(ForceFeedbackBinding *binding, unsigned char force) {}
-	inline virtual void SetEffects(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force);
+	virtual void SetEffects(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force);
 
 	// Called after reading.  Basically calls FlipState().
 	// Some device types (Those that don't incrementally update)
@@ -385,6 +556,10 @@ public:
 	// Finally create new dummy devices if no matches found.
 	void CopyBindings(int numDevices, Device **devices);
 
+	// Adds a device found after bindings were loaded.  If a detached device
+	// from the config matches it, takes that one's place and bindings.
+	// Returns the device's index.
+	int AttachDevice(Device *d);
 
 	InputDeviceManager();
 	~InputDeviceManager();
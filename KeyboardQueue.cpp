@@ -18,6 +18,7 @@
 #include "Global.h"
 // This is undoubtedly completely unnecessary.
 #include "KeyboardQueue.h"
+#include "Stats.h"
 
 // What MS calls a single process Mutex.  Faster, supposedly.
 // More importantly, can be abbreviated, amusingly, as cSection.
@@ -27,6 +28,8 @@ static u8 csInitialized = 0;
 #else
 static std::mutex cSection;
 #endif
+static LockSite queueLockSite("cSection QueueKeyEvent");
+static LockSite getQueuedLockSite("cSection GetQueuedKeyEvent");
 
 #define EVENT_QUEUE_LEN 16
 // Actually points one beyond the last queued event.
@@ -40,10 +43,8 @@ void QueueKeyEvent(int key, int event) {
 		csInitialized = 1;
 		InitializeCriticalSection(&cSection);
 	}
-	EnterCriticalSection(&cSection);
-#else
-	std::lock_guard<std::mutex> lock(cSection);
 #endif
+	ProfiledLock<decltype(cSection)> lock(queueLockSite, cSection);
 
 	// Don't queue events if escape is on top of queue.  This is just for safety
 	// purposes when a game is killing the emulator for whatever reason.
@@ -58,31 +59,26 @@ void QueueKeyEvent(int key, int event) {
 
 			queuedEvents[lastQueuedEvent].key = key;
 			queuedEvents[lastQueuedEvent].evt = event;
+			CountStat(STAT_KEYS_QUEUED);
 
 			lastQueuedEvent = (lastQueuedEvent + 1) % EVENT_QUEUE_LEN;
 			// If queue wrapped around, remove last element.
 			if (nextQueuedEvent == lastQueuedEvent) {
 				nextQueuedEvent = (nextQueuedEvent + 1) % EVENT_QUEUE_LEN;
+				CountStat(STAT_KEYS_DROPPED);
 			}
 	}
-#ifdef _MSC_VER
-	LeaveCriticalSection(&cSection);
-#endif
+	else {
+		CountStat(STAT_KEYS_DROPPED);
+	}
 }
 
 int GetQueuedKeyEvent(keyEvent *event) {
 	if (lastQueuedEvent == nextQueuedEvent) return 0;
 
-#ifdef _MSC_VER
-	EnterCriticalSection(&cSection);
-#else
-	std::lock_guard<std::mutex> lock(cSection);
-#endif
+	ProfiledLock<decltype(cSection)> lock(getQueuedLockSite, cSection);
 	*event = queuedEvents[nextQueuedEvent];
 	nextQueuedEvent = (nextQueuedEvent + 1) % EVENT_QUEUE_LEN;
-#ifdef _MSC_VER
-	LeaveCriticalSection(&cSection);
-#endif
 	return 1;
 }
 
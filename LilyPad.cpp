@@ -26,10 +26,16 @@
 #define PADdefs
 
 #include "DeviceEnumerator.h"
+#include "DevicePoller.h"
 #ifdef _MSC_VER
 #include "WndProcEater.h"
 #endif
 #include "KeyboardQueue.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Log.h"
+#include "Combo.h"
+#include "BindingMath.h"
 #include "svnrev.h"
 #include "DualShock4.h"
 #include "HidDevice.h"
@@ -110,49 +116,10 @@ int IsWindowMaximized(HWND hWnd) {
 }
 #endif
 
-void DEBUG_TEXT_OUT(const char *text) {
-#ifdef _MSC_VER
-	if (config.debug) {
-		HANDLE hFile = CreateFileA("logs\\padLog.txt", FILE_APPEND_DATA, FILE_SHARE_READ, 0, OPEN_ALWAYS, 0, 0);
-		if (hFile != INVALID_HANDLE_VALUE) {
-			DWORD junk;
-			WriteFile(hFile, text, strlen(text), &junk, 0);
-			CloseHandle(hFile);;
-		}
-	}
-#endif
-}
-
 void DEBUG_NEW_SET() {
-#ifdef _MSC_VER
-	if (config.debug && bufSize > 1) {
-		HANDLE hFile = CreateFileA("logs\\padLog.txt", FILE_APPEND_DATA, FILE_SHARE_READ, 0, OPEN_ALWAYS, 0, 0);
-		if (hFile != INVALID_HANDLE_VALUE) {
-			u32 i;
-			char temp[1500];
-			char *end = temp;
-			sprintf(end, "%02X (%02X) ", inBuf[0], inBuf[1]);
-			end += 8;
-			for (i = 2; i < bufSize; i++) {
-				sprintf(end, "%02X ", inBuf[i]);
-				end += 3;
-			}
-			end[-1] = '\n';
-			sprintf(end, "%02X (%02X) ", outBuf[0], outBuf[1]);
-			end += 8;
-			for (i = 2; i < bufSize; i++) {
-				sprintf(end, "%02X ", outBuf[i]);
-				end += 3;
-			}
-			end[-1] = '\n';
-			end++[0] = '\n';
-			DWORD junk;
-			WriteFile(hFile, temp, end - temp, &junk, 0);
-			CloseHandle(hFile);;
-		}
-	}
+	if (bufSize > 1 && LogEnabled(LOGCAT_POLL, LOGLEVEL_DEBUG))
+		LogPoll(inBuf, outBuf, bufSize);
 	bufSize = 0;
-#endif
 }
 
 inline void DEBUG_IN(unsigned char c) {
@@ -318,6 +285,8 @@ void UpdateEnabledDevices(int updateList = 0) {
 }
 
 #ifdef _MSC_VER
+static void Shutdown(bool unloading);
+
 BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD fdwReason, void* lpvReserved) {
 	hInst = hInstance;
 	if (fdwReason == DLL_PROCESS_ATTACH) {
@@ -326,9 +295,12 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD fdwReason, void* lpvReserved) {
 		DisableThreadLibraryCalls(hInstance);
 	}
 	else if (fdwReason == DLL_PROCESS_DETACH) {
+		SetPollingUnloading();
 		while (openCount)
 			PADclose();
-		PADshutdown();
+		// Not PADshutdown(), which waits for threads to exit.  They can't
+		// while DllMain holds the loader lock.
+		Shutdown(true);
 		UninitHid();
 		UninitLibUsb();
 		DeleteCriticalSection(&updateLock);
@@ -473,20 +445,11 @@ char padReadKeyUpdated[4] = { 0, 0, 0, 0 };
 #define LOCK_BUTTONS 4
 #define LOCK_BOTH 1
 
-#ifdef _MSC_VER
-struct EnterScopedSection
-{
-	CRITICAL_SECTION& m_cs;
-
-	EnterScopedSection(CRITICAL_SECTION& cs) : m_cs(cs) {
-		EnterCriticalSection(&m_cs);
-	}
-
-	~EnterScopedSection() {
-		LeaveCriticalSection(&m_cs);
-	}
-};
-#endif
+static LockSite updateRPLockSite("updateLock UpdateRP");
+static LockSite updateAllRPLockSite("updateLock UpdateAllRP");
+static LockSite updateLockSite("updateLock Update");
+static LockSite latencyStatsLockSite("updateLock PADgetLatencyStats");
+static LockSite statsLockSite("updateLock PADgetStats");
 
 int clamp(int min, int val, int max)
 {
@@ -500,6 +463,7 @@ int clamp(int min, int val, int max)
 
 static double mouse2axis(int which, s_mouse_control* mc, double x, double y, double exp, double multiplier, double dead_zone, e_shape shape, e_mouse_mode mode)
 {
+	TRACE_SCOPE("mouse2axis");
 
 	double z = 0;
 	double dz = dead_zone;
@@ -624,19 +588,204 @@ void Output(const char* szFormat, ...)
 	OutputDebugStringA(szBuff);
 }
 
-void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
-	// Lock prior to timecheck code to avoid pesky race conditions.
+// Plain button bindings on devices that track changed controls go through
+// their DigitalMatrix instead of the per binding code.  Flipped ones fire on
+// release, so are left to the latter.
+static inline bool IsMatrixBinding(const Device *dev, const Binding *b) {
+	return dev->changedControls && b->command >= 0x10 && b->command < 34 && b->sensitivity > 0;
+}
 
-#ifdef __linux__
-	std::lock_guard<std::mutex> lock(updateLock);
-#else
-	EnterScopedSection padlock(updateLock);
-#endif
+static void BuildDigitalMatrix(Device *dev, unsigned int port, unsigned int slot) {
+	DigitalMatrix *m = &dev->digital[port][slot];
+	PadBindings *p = &dev->pads[port][slot];
+	m->keys = (int*)realloc(m->keys, (p->numBindings + 1) * sizeof(int));
+	m->masks = (u32*)realloc(m->masks, (p->numBindings + 1) * sizeof(u32));
+	m->turboMasks = (u32*)realloc(m->turboMasks, (p->numBindings + 1) * sizeof(u32));
+	m->numKeys = 0;
+	for (int i = 0; i < p->numBindings; i++) {
+		Binding *b = p->bindings + i;
+		if (!IsMatrixBinding(dev, b)) continue;
+		// Keys are only ever all the way up or down, so this is all that
+		// decides if one can press its button.
+		if (!(ScaleButtonState(b->sensitivity, FULLY_DOWN) > ButtonDeadZone(b->deadZone))) continue;
+		u32 mask = 1u << (b->command - 0x10);
+		// Bindings are sorted by control, so a key's are next to each other.
+		if (!m->numKeys || m->keys[m->numKeys - 1] != b->controlIndex) {
+			m->keys[m->numKeys] = b->controlIndex;
+			m->masks[m->numKeys] = 0;
+			m->turboMasks[m->numKeys++] = 0;
+		}
+		if (b->turbo)
+			m->turboMasks[m->numKeys - 1] |= mask;
+		else
+			m->masks[m->numKeys - 1] |= mask;
+	}
+	m->generation = bindingGeneration;
+}
+
+// By pad.  Written into buttonStatus at the end of each EvaluateRPPad().
+static ButtonSources buttonSources[2][4];
+
+// Like the per binding code, only changes buttons whose keys changed, but a
+// button bound to several keys now stays down until all of them are
+// released.  Buttons held by turbo bindings are added to turboHeld.
+static void UpdateDigitalMatrix(Device *dev, unsigned int port, unsigned int slot, u32 &turboHeld) {
+	DigitalMatrix *m = &dev->digital[port][slot];
+	if (m->generation != bindingGeneration)
+		BuildDigitalMatrix(dev, port, slot);
+	const int *state = dev->physicalControlState;
+	u32 buttons = 0;
+	for (int i = 0; i < m->numKeys; i++) {
+		u32 down = 0u - (state[m->keys[i]] != 0);
+		buttons |= m->masks[i] & down;
+		turboHeld |= m->turboMasks[i] & down;
+	}
+	m->buttons = buttons;
+	buttonSources[port][slot].matrix |= buttons;
+}
+
+static inline bool IsStickBinding(const Device *dev, const Binding *b) {
+	return !dev->isMouse && b->command >= 34 && b->command < 42;
+}
+
+// Index of the RP_OUTPUT_ bit a command writes, or -1 for none.
+static inline int OutputClass(int cmd) {
+	if (cmd >= 0x10 && cmd < 34) return 0;
+	if (cmd >= 34 && cmd < 38) return 1;
+	if (cmd >= 38 && cmd < 42) return 2;
+	return -1;
+}
+
+static void BuildBindingPlan(Device *dev, unsigned int port, unsigned int slot) {
+	BindingPlan *plan = &dev->plans[port][slot];
+	PadBindings *p = &dev->pads[port][slot];
+	plan->bindings = (int*)realloc(plan->bindings, (p->numBindings + 1) * sizeof(int));
+	int n = 0;
+	for (int c = 0; c < BINDING_PLAN_CLASSES; c++) {
+		plan->start[c] = n;
+		for (int i = 0; i < p->numBindings; i++) {
+			Binding *b = p->bindings + i;
+			if (IsMatrixBinding(dev, b) || IsStickBinding(dev, b)) continue;
+			if (OutputClass(b->command) == c)
+				plan->bindings[n++] = i;
+		}
+	}
+	plan->start[BINDING_PLAN_CLASSES] = n;
+	plan->generation = bindingGeneration;
+}
+
+// Parts of each pad's RPPadDataS the host reads.
+static u8 rpOutputs[2][4] = {
+	{ RP_OUTPUT_ALL, RP_OUTPUT_ALL, RP_OUTPUT_ALL, RP_OUTPUT_ALL },
+	{ RP_OUTPUT_ALL, RP_OUTPUT_ALL, RP_OUTPUT_ALL, RP_OUTPUT_ALL },
+};
+
+// Outputs worth evaluating for a pad.  Emulators set the pad's mode over
+// PADpoll, and games never read sticks from a pad in digital mode.
+static inline u32 NeededOutputs(unsigned int port, unsigned int slot) {
+	u32 outputs = rpOutputs[port][slot];
+	if (ps2e && pads[port][slot].mode == MODE_DIGITAL)
+		outputs &= ~(RP_OUTPUT_LEFT_STICK | RP_OUTPUT_RIGHT_STICK);
+	return outputs;
+}
+
+// Each stick gets the largest dead zone and exponent of its bindings, since
+// the dead zone is now radial.  Buttons bound to a stick have neither.
+static void BuildStickProcessor(Device *dev, unsigned int port, unsigned int slot) {
+	StickProcessor *s = dev->sticks[port][slot];
+	if (!s) s = dev->sticks[port][slot] = (StickProcessor*)calloc(1, sizeof(StickProcessor));
+	PadBindings *p = &dev->pads[port][slot];
+	s->inputs = (StickProcessor::StickInput*)realloc(s->inputs, (p->numBindings + 1) * sizeof(StickProcessor::StickInput));
+	s->numInputs = 0;
+	s->axes[0] = s->axes[1] = 0;
+	int deadZone[2] = { 0, 0 };
+	int exponent[2] = { 0, 0 };
+	for (int i = 0; i < p->numBindings; i++) {
+		Binding *b = p->bindings + i;
+		if (!IsStickBinding(dev, b)) continue;
+		StickProcessor::StickInput *in = s->inputs + s->numInputs++;
+		in->controlIndex = b->controlIndex;
+		in->sensitivity = b->sensitivity;
+		in->stick = (b->command - 34) / 4;
+		in->direction = (b->command - 34) & 3;
+		// Right and left are X, up and down are Y.
+		s->axes[in->stick] |= 1 << (1 - (in->direction & 1));
+		if (b->deadZone > deadZone[in->stick]) deadZone[in->stick] = b->deadZone;
+		if (b->Exponent > exponent[in->stick]) exponent[in->stick] = b->Exponent;
+	}
+	for (int stick = 0; stick < 2; stick++)
+		BuildStickCurve(s->curve[stick], deadZone[stick], exponent[stick]);
+	s->generation = bindingGeneration;
+}
+
+// Indices into the axis state EvaluateRPPad() keeps for SetStickAxis().
+enum RPAxis {
+	RP_AXIS_LX,
+	RP_AXIS_LY,
+	RP_AXIS_RX,
+	RP_AXIS_RY,
+	RP_AXES
+};
+
+static void UpdateSticks(Device *dev, unsigned int port, unsigned int slot, RPPadDataS* RPpad, u32 outputs, StickAxisFrame *axisFrames) {
+	StickProcessor *s = dev->sticks[port][slot];
+	if (!s || s->generation != bindingGeneration) {
+		BuildStickProcessor(dev, port, slot);
+		s = dev->sticks[port][slot];
+	}
+	if (!s->numInputs) return;
+
+	// Strongest binding in each direction, with FULLY_DOWN as all the way.
+	int directions[2][4] = { { 0 } };
+	for (int i = 0; i < s->numInputs; i++) {
+		StickProcessor::StickInput *in = s->inputs + i;
+		int state = dev->virtualControlState[in->controlIndex];
+		int sensitivity = in->sensitivity;
+		if (sensitivity < 0) {
+			sensitivity = -sensitivity;
+			state = FULLY_DOWN - state;
+		}
+		state = (int)((__int64)state * sensitivity / BASE_SENSITIVITY);
+		if (state > directions[in->stick][in->direction])
+			directions[in->stick][in->direction] = state;
+	}
+
+	for (int stick = 0; stick < 2; stick++) {
+		if (!s->axes[stick] || !(outputs & (RP_OUTPUT_LEFT_STICK << stick))) continue;
+		int x = directions[stick][1] - directions[stick][3];
+		int y = directions[stick][2] - directions[stick][0];
+		int outX, outY;
+		ApplyStickCurve(s->curve[stick], x, y, outX, outY);
+		if (stick == 0) {
+			if (s->axes[0] & 1) SetStickAxis(RPpad->leftJoyX, RPpad->axisLXUpdate, axisFrames[RP_AXIS_LX], outX);
+			if (s->axes[0] & 2) SetStickAxis(RPpad->leftJoyY, RPpad->axisLYUpdate, axisFrames[RP_AXIS_LY], outY);
+		}
+		else {
+			if (s->axes[1] & 1) SetStickAxis(RPpad->rightJoyX, RPpad->axisRXUpdate, axisFrames[RP_AXIS_RX], outX);
+			if (s->axes[1] & 2) SetStickAxis(RPpad->rightJoyY, RPpad->axisRYUpdate, axisFrames[RP_AXIS_RY], outY);
+		}
+	}
+}
+
+// Remote Play frames are split in three, so any number of pads can be
+// evaluated from one read of the devices:  BeginRPFrame() updates every
+// device once, EvaluateRPPad() runs one pad's bindings against that state,
+// and EndRPFrame() flips device state for the next frame.  All three need
+// updateLock held.
+
+// Returns 0 if it's too soon since the last frame, or devices can't be
+// read from this thread, in which case there's nothing to evaluate.
+static int BeginRPFrame(unsigned int &t) {
 	static unsigned int LastCheck = 0;
-	unsigned int t = timeGetTime();
-	if (t - LastCheck < 10 || !openCount) return;
+	t = timeGetTime();
+	if (t - LastCheck < 10 || !openCount) {
+		CountStat(STAT_FRAMES_GATED);
+		return 0;
+	}
 
 	LastCheck = t;
+	CountStat(STAT_FRAMES);
+	MirrorStats();
 
 #ifdef __linux__
 	InitInfo info = {
@@ -655,32 +804,63 @@ void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
 		//	updateQueued = 1;
 		//	PostMessage(hWnd, WMA_FORCE_UPDATE, FORCE_UPDATE_WPARAM, FORCE_UPDATE_LPARAM);
 		//}
-		return;
+		return 0;
 	}
 #endif
 
+	AttachEnumeratedDevices();
 	dm->Update(&info);
+	// Before any pad's bindings replace bound controls' state.
+	UpdateCombos(t);
+	return 1;
+}
+
+static inline bool RPPadEnabled(unsigned int port, unsigned int slot) {
+	return config.padConfigs[port][slot].type != DisabledPad && pads[port][slot].initialized;
+}
+
+static void EvaluateRPPad(unsigned int port, unsigned int slot, RPPadDataS* RPpad, unsigned int t) {
+	u32 turboHeld = 0;
+	u32 outputs = NeededOutputs(port, slot);
+	ButtonSources *sources = &buttonSources[port][slot];
+	sources->matrix = 0;
+	StickAxisFrame axisFrames[RP_AXES];
+	memset(axisFrames, 0, sizeof(axisFrames));
 	for (int i = 0; i < dm->numDevices; i++) {
 		Device *dev = dm->devices[i];
 		// Skip both disabled devices and inactive enabled devices.
 		// Shouldn't be any of the latter, in general, but just in case...
 		if (!dev->active) continue;
-		if (config.padConfigs[port][slot].type == DisabledPad || !pads[port][slot].initialized) continue;
-		for (int j = 0; j < dev->pads[port][slot].numBindings; j++) {
-			Binding *b = dev->pads[port][slot].bindings + j;
-			int cmd = b->command;
-			int sensitivity = b->sensitivity;
-			int state = dev->virtualControlState[b->controlIndex];
-			double dz = (double)b->deadZone / BASE_SENSITIVITY;
-			if (cmd > 0x0F) {
-
+		if (!RPPadEnabled(port, slot)) continue;
+		TRACE_SCOPE("UpdateRP bindings");
+		// To tell if this device's input made it to the host this frame.
+		// Buttons are only written once every device's had its say.
+		RPPadDataS before;
+		memcpy(&before, RPpad, sizeof(before));
+		u32 bindingsBefore = sources->bindings;
+		u32 matrixBefore = dev->digital[port][slot].buttons;
+		if (dev->changedControls && (outputs & RP_OUTPUT_BUTTONS))
+			UpdateDigitalMatrix(dev, port, slot, turboHeld);
+		if (!dev->isMouse && (outputs & (RP_OUTPUT_LEFT_STICK | RP_OUTPUT_RIGHT_STICK)))
+			UpdateSticks(dev, port, slot, RPpad, outputs, axisFrames);
+		BindingPlan *plan = &dev->plans[port][slot];
+		if (plan->generation != bindingGeneration)
+			BuildBindingPlan(dev, port, slot);
+		for (int c = 0; c < BINDING_PLAN_CLASSES; c++) {
+			if (!(outputs & (1 << c))) continue;
+			for (int j = plan->start[c]; j < plan->start[c + 1]; j++) {
+				Binding *b = dev->pads[port][slot].bindings + plan->bindings[j];
+				int cmd = b->command;
+				int sensitivity = b->sensitivity;
+				int state = dev->virtualControlState[b->controlIndex];
+				double dz = (double)b->deadZone / BASE_SENSITIVITY;
 				if (dev->isMouse && cmd > 33){
 					double exp = (double)b->Exponent / BASE_SENSITIVITY;
 					double sen = (double)b->sensitivity / BASE_SENSITIVITY;
-					if (((cmd == 35 || cmd == 39) && dev->mc.x > 0) || ((cmd == 37 || cmd == 41) && dev->mc.x < 0))
-						state = abs(mouse2axis(0, &dev->mc, dev->mc.x, dev->mc.y, exp/*0.85*/, sen/*15*/, dz/*0*/, E_SHAPE_CIRCLE, E_MOUSE_MODE_AIMING));
-					else if (((cmd == 34 || cmd == 38) && dev->mc.y < 0) || ((cmd == 36 || cmd == 40) && dev->mc.y > 0))
-						state = abs(mouse2axis(1, &dev->mc, dev->mc.x, dev->mc.y, exp, sen, dz, E_SHAPE_CIRCLE, E_MOUSE_MODE_AIMING));
+					if (((cmd == 35 || cmd == 39) && dev->mc->x > 0) || ((cmd == 37 || cmd == 41) && dev->mc->x < 0))
+						state = abs(mouse2axis(0, dev->mc, dev->mc->x, dev->mc->y, exp/*0.85*/, sen/*15*/, dz/*0*/, E_SHAPE_CIRCLE, E_MOUSE_MODE_AIMING));
+					else if (((cmd == 34 || cmd == 38) && dev->mc->y < 0) || ((cmd == 36 || cmd == 40) && dev->mc->y > 0))
+						state = abs(mouse2axis(1, dev->mc, dev->mc->x, dev->mc->y, exp, sen, dz, E_SHAPE_CIRCLE, E_MOUSE_MODE_AIMING));
 					else
 						continue;
 				}
@@ -692,108 +872,67 @@ void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
 				}
 
 				if (!dev->isMouse)
-					state = (int)((((sensitivity*(127 * (__int64)state)) + BASE_SENSITIVITY / 2) / BASE_SENSITIVITY + FULLY_DOWN / 2) / FULLY_DOWN);
+					state = ScaleButtonState(sensitivity, state);
 
 				dev->virtualControlState[b->controlIndex] = state;
 
 				//if (state == dev->oldVirtualControlState[b->controlIndex]) continue;
 
-				int btnVal = (1 << (cmd - 0x10));
-
-				if (state > dz){
-
-					if (cmd < 34) {
-						if (state == dev->oldVirtualControlState[b->controlIndex]) continue;
-						if ((RPpad->buttonStatus & btnVal) == 0){
-							//Output("BTN ON:%d", btnVal);
-							RPpad->buttonStatus ^= btnVal;
-							RPpad->btnUpdate = true;
-						}
-
+				if (cmd < 34) {
+					int btnVal = (1 << (cmd - 0x10));
+					if (b->turbo) {
+						if (state > ButtonDeadZone(b->deadZone)) turboHeld |= btnVal;
+						continue;
 					}
+					if (state == dev->oldVirtualControlState[b->controlIndex]) continue;
+					bool analog = !((dev->virtualControls[b->controlIndex].uid >> 16) & (PSHBTN | TGLBTN));
+					bool wasDown = (sources->bindings & btnVal) != 0;
+					if (ButtonDown(wasDown, state, b->deadZone, analog) != wasDown) {
+						//Output("BTN %s:%d", wasDown ? "OFF" : "ON", btnVal);
+						sources->bindings ^= btnVal;
+					}
+				}
+				else if (state > dz){
 					// Left stick.
-					else if (cmd < 38) {
+					if (cmd < 38) {
 						//Output("cmd: %d	val: %d\n", cmd, state);
-						if (cmd == 34){
-							RPpad->leftJoyY = -state;
-							RPpad->axisLYUpdate = true;
-						}
-						else if (cmd == 35){
-							RPpad->leftJoyX = state;
-							RPpad->axisLXUpdate = true;
-						}
-						else if (cmd == 36){
-							RPpad->leftJoyY = state;
-							RPpad->axisLYUpdate = true;
-						}
-						else if (cmd == 37){
-							RPpad->leftJoyX = -state;
-							RPpad->axisLXUpdate = true;
-						}
+						if (cmd == 34)
+							SetStickAxis(RPpad->leftJoyY, RPpad->axisLYUpdate, axisFrames[RP_AXIS_LY], -state);
+						else if (cmd == 35)
+							SetStickAxis(RPpad->leftJoyX, RPpad->axisLXUpdate, axisFrames[RP_AXIS_LX], state);
+						else if (cmd == 36)
+							SetStickAxis(RPpad->leftJoyY, RPpad->axisLYUpdate, axisFrames[RP_AXIS_LY], state);
+						else if (cmd == 37)
+							SetStickAxis(RPpad->leftJoyX, RPpad->axisLXUpdate, axisFrames[RP_AXIS_LX], -state);
 					}
 					// Right stick.
 					else if (cmd < 42) {
 						//Output("cmd: %d	val: %d\n", cmd, state);
-						if (cmd == 38){
-							RPpad->rightJoyY = -state;
-							RPpad->axisRYUpdate = true;
-						}
-						else if (cmd == 39){
-							RPpad->rightJoyX = state;
-							RPpad->axisRXUpdate = true;
-						}
-						else if (cmd == 40){
-							RPpad->rightJoyY = state;
-							RPpad->axisRYUpdate = true;
-						}
-						else if (cmd == 41){
-							RPpad->rightJoyX = -state;
-							RPpad->axisRXUpdate = true;
-						}
+						if (cmd == 38)
+							SetStickAxis(RPpad->rightJoyY, RPpad->axisRYUpdate, axisFrames[RP_AXIS_RY], -state);
+						else if (cmd == 39)
+							SetStickAxis(RPpad->rightJoyX, RPpad->axisRXUpdate, axisFrames[RP_AXIS_RX], state);
+						else if (cmd == 40)
+							SetStickAxis(RPpad->rightJoyY, RPpad->axisRYUpdate, axisFrames[RP_AXIS_RY], state);
+						else if (cmd == 41)
+							SetStickAxis(RPpad->rightJoyX, RPpad->axisRXUpdate, axisFrames[RP_AXIS_RX], -state);
 					}
 				}
 				else{
-					if (cmd < 34) {
-						if (state == dev->oldVirtualControlState[b->controlIndex]) continue;
-						if ((RPpad->buttonStatus & btnVal) > 0)
-						{
-							//Output("BTN OFF:%d", btnVal);
-							RPpad->buttonStatus ^= btnVal;
-							RPpad->btnUpdate = true;
-						}
-
-					}
 					// Left stick.
-					else if (cmd < 38) {
-						if (cmd == 34 || cmd == 36){
-							if (!RPpad->axisLYUpdate){
-								RPpad->leftJoyY = 0;
-								RPpad->axisLYUpdate = true;
-							}
-						}
-						else if (cmd == 35 || cmd == 37){
-							if (!RPpad->axisLXUpdate){
-								RPpad->leftJoyX = 0;
-								RPpad->axisLXUpdate = true;
-							}
-						}
+					if (cmd < 38) {
+						if (cmd == 34 || cmd == 36)
+							SetStickAxis(RPpad->leftJoyY, RPpad->axisLYUpdate, axisFrames[RP_AXIS_LY], 0);
+						else if (cmd == 35 || cmd == 37)
+							SetStickAxis(RPpad->leftJoyX, RPpad->axisLXUpdate, axisFrames[RP_AXIS_LX], 0);
 					}
 					// Right stick.
 					else if (cmd < 42) {
-						if (cmd == 38 || cmd == 40){
-							if (!RPpad->axisRYUpdate){
-								RPpad->rightJoyY = 0;
-								RPpad->axisRYUpdate = true;
-							}
-						}
-						else if (cmd == 39 || cmd == 41){
-							if (!RPpad->axisRXUpdate){
-								RPpad->rightJoyX = 0;
-								RPpad->axisRXUpdate = true;
-							}
-						}
+						if (cmd == 38 || cmd == 40)
+							SetStickAxis(RPpad->rightJoyY, RPpad->axisRYUpdate, axisFrames[RP_AXIS_RY], 0);
+						else if (cmd == 39 || cmd == 41)
+							SetStickAxis(RPpad->rightJoyX, RPpad->axisRXUpdate, axisFrames[RP_AXIS_RX], 0);
 					}
-
 				}
 				//else if ((state >> 15) && !(dev->oldVirtualControlState[b->controlIndex] >> 15)) {
 				//	if (cmd == 0x0F) {
@@ -820,8 +959,22 @@ void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
 				//}
 			}
 		}
+		// Only the first pad it reaches counts.
+		if (memcmp(&before, RPpad, sizeof(before)) || sources->bindings != bindingsBefore ||
+			dev->digital[port][slot].buttons != matrixBefore) {
+			RecordInputLatency(dev, MonotonicUs());
+			dev->inputReadTime = 0;
+		}
+	}
+	if (outputs & RP_OUTPUT_BUTTONS) {
+		StepTurbo(sources, turboHeld);
+		sources->combos = ComboButtons(port, slot, t);
+		u32 buttons = SourceButtons(sources);
+		if (buttons != RPpad->buttonStatus) {
+			RPpad->buttonStatus = buttons;
+			RPpad->btnUpdate = true;
+		}
 	}
-	dm->PostRead();
 
 	CapSumRP(RPpad);
 
@@ -834,6 +987,69 @@ void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
 	}
 }
 
+static void EndRPFrame() {
+	dm->PostRead();
+	// Input that didn't change anything this frame isn't going to be what
+	// changes it later.
+	for (int i = 0; i < dm->numDevices; i++)
+		dm->devices[i]->inputReadTime = 0;
+
+#ifdef LILYPAD_ALLOC_STATS
+	CheckFrameAllocations();
+#endif
+}
+
+void UpdateRP(unsigned int port, unsigned int slot, RPPadDataS* RPpad){
+	// Starts before the lock, so the gap before "UpdateRP locked" is the wait.
+	TRACE_SCOPE("UpdateRP");
+	// Lock prior to timecheck code to avoid pesky race conditions.
+
+	ProfiledLock<decltype(updateLock)> lock(updateRPLockSite, updateLock);
+	TRACE_SCOPE("UpdateRP locked");
+	unsigned int t;
+	if (!BeginRPFrame(t)) return;
+	EvaluateRPPad(port, slot, RPpad, t);
+	EndRPFrame();
+}
+
+// Same test for saving and restoring, so they always cover the same devices.
+static inline bool HasSampledState(const Device *dev) {
+	return dev->active && dev->virtualControlState && dev->sampledControlState;
+}
+
+// Every enabled pad from one frame.  RPpads is indexed by port * 4 + slot.
+static u32 UpdateAllRP(RPPadDataS* RPpads) {
+	TRACE_SCOPE("UpdateAllRP");
+	ProfiledLock<decltype(updateLock)> lock(updateAllRPLockSite, updateLock);
+	unsigned int t;
+	if (!BeginRPFrame(t)) return 0;
+	// Bindings scale bound controls' state in place, so each pad after the
+	// first needs the state as it was read.  Only active devices have state
+	// to save, and only they are evaluated.
+	for (int i = 0; i < dm->numDevices; i++) {
+		Device *dev = dm->devices[i];
+		if (!HasSampledState(dev)) continue;
+		memcpy(dev->sampledControlState, dev->virtualControlState, sizeof(int) * dev->numVirtualControls);
+	}
+	u32 updated = 0;
+	for (unsigned int port = 0; port < 2; port++) {
+		for (unsigned int slot = 0; slot < 4; slot++) {
+			if (!RPPadEnabled(port, slot)) continue;
+			if (updated) {
+				for (int i = 0; i < dm->numDevices; i++) {
+					Device *dev = dm->devices[i];
+					if (!HasSampledState(dev)) continue;
+					memcpy(dev->virtualControlState, dev->sampledControlState, sizeof(int) * dev->numVirtualControls);
+				}
+			}
+			EvaluateRPPad(port, slot, RPpads + port * 4 + slot, t);
+			updated |= 1 << (port * 4 + slot);
+		}
+	}
+	EndRPFrame();
+	return updated;
+}
+
 void Update(unsigned int port, unsigned int slot) {
 	char *stateUpdated;
 	if (port < 2) {
@@ -845,11 +1061,7 @@ void Update(unsigned int port, unsigned int slot) {
 	else return;
 
 	// Lock prior to timecheck code to avoid pesky race conditions.
-#ifdef __linux__
-	std::lock_guard<std::mutex> lock(updateLock);
-#else
-	EnterScopedSection padlock(updateLock);
-#endif
+	ProfiledLock<decltype(updateLock)> lock(updateLockSite, updateLock);
 
 	static unsigned int LastCheck = 0;
 	unsigned int t = timeGetTime();
@@ -926,12 +1138,18 @@ char* CALLBACK PS2EgetLibName(void) {
 //	info=info;
 //}
 
-void CALLBACK PADshutdown() {
-	DEBUG_TEXT_OUT("LilyPad shutdown.\n\n");
+// unloading is set when called from DllMain, with the loader lock held.
+static void Shutdown(bool unloading) {
+	LOG(LOGCAT_GENERAL, LOGLEVEL_INFO, "LilyPad shutdown.\n\n");
 	for (int i = 0; i < 8; i++)
 		pads[i & 1][i >> 1].initialized = 0;
 	portInitialized[0] = portInitialized[1] = 0;
 	UnloadConfigs();
+	LogStop(unloading);
+}
+
+void CALLBACK PADshutdown() {
+	Shutdown(false);
 }
 
 inline void StopVibrate() {
@@ -1021,7 +1239,7 @@ s32 CALLBACK PADinit(u32 flags) {
 	// Just in case, when resuming emulation.
 	ReleaseModifierKeys();
 
-	DEBUG_TEXT_OUT("LilyPad initialized\n\n");
+	LOG(LOGCAT_GENERAL, LOGLEVEL_INFO, "LilyPad initialized\n\n");
 	return 0;
 }
 
@@ -1217,7 +1435,7 @@ void SaveStateChanged() {
 
 s32 CALLBACK PADopen(void *pDsp) {
 	if (openCount++) return 0;
-	DEBUG_TEXT_OUT("LilyPad opened\n\n");
+	LOG(LOGCAT_GENERAL, LOGLEVEL_INFO, "LilyPad opened\n\n");
 
 	miceEnabled = !config.mouseUnfocus;
 #ifdef _MSC_VER
@@ -1309,7 +1527,7 @@ s32 CALLBACK PADopen(void *pDsp) {
 
 void CALLBACK PADclose() {
 	if (openCount && !--openCount) {
-		DEBUG_TEXT_OUT("LilyPad closed\n\n");
+		LOG(LOGCAT_GENERAL, LOGLEVEL_INFO, "LilyPad closed\n\n");
 #ifdef _MSC_VER
 		updateQueued = 0;
 		hWndGSProc.Release();
@@ -1321,6 +1539,7 @@ void CALLBACK PADclose() {
 		R_ClearKeyQueue();
 #endif
 		ClearKeyQueue();
+		TRACE_DUMP();
 	}
 }
 
@@ -1804,6 +2023,22 @@ u32 CALLBACK PADreadPort1(RPPadDataS* RPpad) {
 
 }
 
+u32 CALLBACK PADreadAllPorts(RPPadDataS* RPpads, u32 *updated) {
+	if (updated) *updated = 0;
+	if (!configuring && !openCount)
+		return 1;
+	else if (configuring)
+		return 2;
+	u32 written = UpdateAllRP(RPpads);
+	if (updated) *updated = written;
+	return 0;
+}
+
+void CALLBACK PADsetOutputs(u8 port, u8 slot, u32 outputs) {
+	if (port < 2 && slot < 4)
+		rpOutputs[port][slot] = (u8)(outputs & RP_OUTPUT_ALL);
+}
+
 u32 CALLBACK PADreadPort2(RPPadDataS* RPpad) {
 	PADstartPoll(2);
 	PADpoll(0x42);
@@ -1812,6 +2047,16 @@ u32 CALLBACK PADreadPort2(RPPadDataS* RPpad) {
 	return 0;
 }
 
+u32 CALLBACK PADgetLatencyStats(char *out, u32 size) {
+	ProfiledLock<decltype(updateLock)> lock(latencyStatsLockSite, updateLock);
+	return FormatLatencyStats(out, size);
+}
+
+u32 CALLBACK PADgetStats(char *out, u32 size) {
+	ProfiledLock<decltype(updateLock)> lock(statsLockSite, updateLock);
+	return FormatStats(out, size);
+}
+
 u32 CALLBACK PSEgetLibType() {
 	return 8;
 }
@@ -20,6 +20,9 @@
 #include "InputManager.h"
 #include "Config.h"
 #include "DeviceEnumerator.h"
+#include "Trace.h"
+#include "Log.h"
+#include "Combo.h"
 #include "Linux/ConfigHelper.h"
 
 GeneralConfig config;
@@ -81,11 +84,12 @@ struct GeneralSettingsBool {
 
 // XXX: I try to remove only gui stuff
 void DeleteBinding(int port, int slot, Device *dev, Binding *b) {
-	fprintf(stderr, "delete binding %d:%d\n", port, slot);
+	LOG(LOGCAT_CONFIG, LOGLEVEL_DEBUG, "delete binding %d:%d\n", port, slot);
 	Binding *bindings = dev->pads[port][slot].bindings;
 	int i = b - bindings;
 	memmove(bindings+i, bindings+i+1, sizeof(Binding) * (dev->pads[port][slot].numBindings - i - 1));
 	dev->pads[port][slot].numBindings--;
+	bindingGeneration++;
 }
 
 void DeleteBinding(int port, int slot, Device *dev, ForceFeedbackBinding *b) {
@@ -95,6 +99,40 @@ void DeleteBinding(int port, int slot, Device *dev, ForceFeedbackBinding *b) {
 	dev->pads[port][slot].numFFBindings--;
 }
 
+int CreateEffectBinding(Device *dev, wchar_t *effectID, unsigned int port, unsigned int slot, unsigned int motor, ForceFeedbackBinding **binding) {
+	// Checks needed because I use this directly when loading bindings.
+	// Note: dev->numFFAxes *can* be 0, for loading from file.
+	*binding = 0;
+	if (port > 1 || slot>3 || motor > 1 || !dev->numFFEffectTypes) {
+		return -1;
+	}
+	ForceFeedbackEffectType *eff = 0;
+	if (effectID) {
+		eff = dev->GetForcefeedbackEffect(effectID);
+	}
+	if (!eff) {
+		eff = dev->ffEffectTypes;
+	}
+	if (!eff) {
+		return -1;
+	}
+	int effectIndex = eff - dev->ffEffectTypes;
+	PadBindings *p = dev->pads[port]+slot;
+	p->ffBindings = (ForceFeedbackBinding*) realloc(p->ffBindings, (p->numFFBindings+1) * sizeof(ForceFeedbackBinding));
+	int newIndex = p->numFFBindings;
+	while (newIndex && p->ffBindings[newIndex-1].motor >= motor) {
+		p->ffBindings[newIndex] = p->ffBindings[newIndex-1];
+		newIndex--;
+	}
+	ForceFeedbackBinding *b = p->ffBindings + newIndex;
+	b->axes = (AxisEffectInfo*) calloc(dev->numFFAxes, sizeof(AxisEffectInfo));
+	b->motor = motor;
+	b->effectIndex = effectIndex;
+	p->numFFBindings++;
+	if (binding) *binding = b;
+	return 0;
+}
+
 int BindCommand(Device *dev, unsigned int uid, unsigned int port, unsigned int slot, int command, int sensitivity, int turbo, int deadZone) {
 	// Checks needed because I use this directly when loading bindings.
 	if (port > 1 || slot>3) {
@@ -134,6 +172,7 @@ int BindCommand(Device *dev, unsigned int uid, unsigned int port, unsigned int s
 	b->turbo = turbo;
 	b->sensitivity = sensitivity;
 	b->deadZone = deadZone;
+	bindingGeneration++;
 	// Where it appears in listview.
 	//int count = ListBoundCommand(port, slot, dev, b);
 
@@ -283,20 +322,27 @@ int SaveSettings(wchar_t *file=0) {
 						ForceFeedbackAxis *axis = dev->ffAxes + k;
 						AxisEffectInfo *info = b->axes + k;
 						//wsprintfW(wcschr(temp2,0), L", %i, %i", axis->id, info->force);
-						// Not secure because I'm too lazy to compute the remaining size
-						wprintf(wcschr(temp2, 0), L", %i, %i", axis->id, info->force);
+						wchar_t *end = wcschr(temp2, 0);
+						swprintf(end, sizeof(temp2)/sizeof(temp2[0]) - (end - temp2), L", %i, %i", axis->id, info->force);
 					}
 					cfg.WriteStr(id, temp, temp2);
 				}
 			}
 		}
 	}
+	for (int i=0; i<numCombos; i++) {
+		wchar_t temp[50], temp2[1000];
+		wsprintfW(temp, L"Combo %i", i);
+		if (FormatCombo(combos+i, temp2, 1000))
+			cfg.WriteStr(L"Combos", temp, temp2);
+	}
 
 	return 0;
 }
 
 int LoadSettings(int force, wchar_t *file) {
 	if (dm && !force) return 0;
+	TRACE_SCOPE("LoadSettings");
 
 	// Could just do ClearDevices() instead, but if I ever add any extra stuff,
 	// this will still work.
@@ -308,6 +354,7 @@ int LoadSettings(int force, wchar_t *file) {
 	for (size_t i=0; i<sizeof(BoolOptionsInfo)/sizeof(BoolOptionsInfo[0]); i++) {
 		config.bools[i] = cfg.ReadBool(L"General Settings", BoolOptionsInfo[i].name, BoolOptionsInfo[i].defaultValue);
 	}
+	LogConfigure(config.debug);
 
 
 	config.closeHacks = (u8)cfg.ReadInt(L"General Settings", L"Close Hacks");
@@ -421,7 +468,6 @@ int LoadSettings(int force, wchar_t *file) {
 					dev->AddFFEffectType(temp2, temp2, EFFECT_CONSTANT);
 					// eff = &dev->ffEffectTypes[dev->numFFEffectTypes-1];
 				}
-#if 0
 				ForceFeedbackBinding *b;
 				CreateEffectBinding(dev, temp2, port, slot, motor, &b);
 				if (b) {
@@ -442,10 +488,24 @@ int LoadSettings(int force, wchar_t *file) {
 						s++;
 					}
 				}
-#endif
 			}
 		}
 	}
+	ClearCombos();
+	for (int i=0; i<100; i++) {
+		wchar_t temp[50], temp2[1000];
+		wsprintfW(temp, L"Combo %i", i);
+		if (!cfg.ReadStr(L"Combos", temp, temp2)) continue;
+		Combo combo;
+		int devices[COMBO_MAX_INPUTS];
+		if (!ParseCombo(temp2, &combo, devices)) continue;
+		for (int j=0; j<combo.numInputs; j++) {
+			wsprintfW(temp, L"Device %i", devices[j]);
+			cfg.ReadStr(temp, L"Instance ID", temp2);
+			combo.inputs[j].instanceID = wcsdup(temp2);
+		}
+		AddCombo(&combo);
+	}
 	config.multipleBinding = multipleBinding;
 
 	//TODO RefreshEnabledDevicesAndDisplay(1);
@@ -455,6 +515,7 @@ int LoadSettings(int force, wchar_t *file) {
 }
 
 void UnloadConfigs() {
+	StopEnumeration();
 	if (dm) {
 		delete dm;
 		dm = 0;
@@ -0,0 +1,357 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2015  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "Linux/EvdevIO.h"
+#include "Stats.h"
+#include "Log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+class SystemEvdevIO : public EvdevIO {
+	public:
+		int NumNodes() {
+			return 32;
+		}
+
+		int Open(int node) {
+			std::string dev = "/dev/input/event" + std::to_string(node);
+			return open(dev.c_str(), O_RDWR | O_NONBLOCK);
+		}
+
+		int Close(int fd) {
+			return close(fd);
+		}
+
+		int Ioctl(int fd, unsigned long request, void *arg) {
+			return ioctl(fd, request, arg);
+		}
+
+		ssize_t Read(int fd, void *buf, size_t len) {
+			return read(fd, buf, len);
+		}
+
+		ssize_t Write(int fd, const void *buf, size_t len) {
+			return write(fd, buf, len);
+		}
+};
+
+static SystemEvdevIO system_io;
+EvdevIO *evdev_io = &system_io;
+
+void InitEvdevIO() {
+	static bool initialized = false;
+	if (initialized) return;
+	initialized = true;
+
+	const char *fake = getenv("LILYPAD_FAKE_EVDEV");
+	int count = fake ? atoi(fake) : 0;
+	if (count > 0) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_INFO, "Using %d fake evdev devices\n", count);
+		FakeEvdevIO *io = new FakeEvdevIO();
+		io->AddDevices(count);
+		evdev_io = io;
+	}
+}
+
+// Well clear of anything real, so mixing them up fails loudly.
+#define FAKE_FD_BASE 0x100000
+// Same as the kernel's default evdev buffer.
+#define FAKE_QUEUE_LEN 1024
+
+FakeEvdevIO::FakeEvdevIO() : m_stim_stop(false), m_stim_record(0) {
+}
+
+FakeEvdevIO::~FakeEvdevIO() {
+	if (m_stim_thread.joinable()) {
+		m_stim_stop = true;
+		m_stim_thread.join();
+	}
+	for (size_t i = 0; i < m_nodes.size(); i++)
+		delete m_nodes[i];
+}
+
+FakeEvdevIO::fake_node *FakeEvdevIO::Node(int fd) {
+	int node = fd - FAKE_FD_BASE;
+	if (node < 0 || node >= (int)m_nodes.size()) {
+		errno = EBADF;
+		return 0;
+	}
+	return m_nodes[node];
+}
+
+int FakeEvdevIO::AddDevice(const input_id &id, const char *name, const evdev_caps &caps) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	fake_node *n = new fake_node;
+	n->id = id;
+	n->name = name;
+	n->phys = "fake/input" + std::to_string(m_nodes.size());
+	n->caps = caps;
+	memset(n->key_state, 0, sizeof(n->key_state));
+	n->next_effect = 0;
+	m_nodes.push_back(n);
+	return m_nodes.size() - 1;
+}
+
+static void SetBit(uint8_t *bits, int bit) {
+	bits[ucharIndexForBit(bit)] |= ucharValueForBit(bit);
+}
+
+static void SetAbs(evdev_caps &caps, int code, int min, int max, int fuzz, int flat) {
+	SetBit(caps.abs, code);
+	caps.absinfo[code].minimum = min;
+	caps.absinfo[code].maximum = max;
+	caps.absinfo[code].value = (min + max) / 2;
+	caps.absinfo[code].fuzz = fuzz;
+	caps.absinfo[code].flat = flat;
+}
+
+void FakeEvdevIO::AddDevices(int count) {
+	evdev_caps pad, keyboard, mouse;
+	memset(&pad, 0, sizeof(pad));
+	memset(&keyboard, 0, sizeof(keyboard));
+	memset(&mouse, 0, sizeof(mouse));
+
+	for (int bit = BTN_SOUTH; bit <= BTN_THUMBR; bit++)
+		SetBit(pad.key, bit);
+	SetAbs(pad, ABS_X, -32768, 32767, 16, 128);
+	SetAbs(pad, ABS_Y, -32768, 32767, 16, 128);
+	SetAbs(pad, ABS_RX, -32768, 32767, 16, 128);
+	SetAbs(pad, ABS_RY, -32768, 32767, 16, 128);
+	SetAbs(pad, ABS_Z, 0, 255, 0, 0);
+	SetAbs(pad, ABS_RZ, 0, 255, 0, 0);
+	SetAbs(pad, ABS_HAT0X, -1, 1, 0, 0);
+	SetAbs(pad, ABS_HAT0Y, -1, 1, 0, 0);
+	SetBit(pad.ff, FF_RUMBLE);
+
+	for (int bit = KEY_ESC; bit <= KEY_MICMUTE; bit++)
+		SetBit(keyboard.key, bit);
+
+	for (int bit = BTN_LEFT; bit <= BTN_TASK; bit++)
+		SetBit(mouse.key, bit);
+	SetBit(mouse.rel, REL_X);
+	SetBit(mouse.rel, REL_Y);
+	SetBit(mouse.rel, REL_WHEEL);
+
+	for (int i = 0; i < count; i++) {
+		input_id id;
+		memset(&id, 0, sizeof(id));
+		id.bustype = BUS_USB;
+		id.vendor = 0x1234;
+		id.version = 1;
+		char name[64];
+		switch (i % 4) {
+			case 0:
+			case 1:
+				id.product = 0x100 + i % 4;
+				snprintf(name, sizeof(name), "Fake Pad %d", i);
+				AddDevice(id, name, pad);
+				break;
+			case 2:
+				id.product = 0x200;
+				snprintf(name, sizeof(name), "Fake Keyboard %d", i);
+				AddDevice(id, name, keyboard);
+				break;
+			default:
+				id.product = 0x300;
+				snprintf(name, sizeof(name), "Fake Mouse %d", i);
+				AddDevice(id, name, mouse);
+				break;
+		}
+	}
+}
+
+void FakeEvdevIO::PushEvent(int node, uint16_t type, uint16_t code, int32_t value) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (node < 0 || node >= (int)m_nodes.size()) return;
+	fake_node *n = m_nodes[node];
+
+	if (type == EV_KEY && code < KEY_CNT) {
+		if (value)
+			SetBit(n->key_state, code);
+		else
+			n->key_state[ucharIndexForBit(code)] &= ~ucharValueForBit(code);
+	} else if (type == EV_ABS && code < ABS_CNT) {
+		n->caps.absinfo[code].value = value;
+	}
+
+	input_event ev;
+	uint64_t now = MonotonicUs();
+	ev.time.tv_sec = now / 1000000;
+	ev.time.tv_usec = now % 1000000;
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+
+	if (n->events.size() >= FAKE_QUEUE_LEN) {
+		n->events.clear();
+		ev.type = EV_SYN;
+		ev.code = SYN_DROPPED;
+		ev.value = 0;
+	}
+	n->events.push_back(ev);
+}
+
+void FakeEvdevIO::StartStimulus(int node, uint16_t code, int hz) {
+	if (m_stim_thread.joinable()) return;
+	m_stim_thread = std::thread(&FakeEvdevIO::RunStimulus, this, node, code, hz);
+}
+
+void FakeEvdevIO::GetStimulus(uint32_t *transitions, uint64_t *timeUs) {
+	uint64_t record = m_stim_record;
+	*transitions = (uint32_t)(record & STIM_COUNT_MASK);
+	*timeUs = record >> STIM_COUNT_BITS;
+}
+
+void FakeEvdevIO::RunStimulus(int node, uint16_t code, int hz) {
+	uint64_t period = 1000000 / hz;
+	uint64_t next = MonotonicUs() + period;
+	int value = 0;
+	while (!m_stim_stop) {
+		// Sleep to the deadline rather than for a period, so it doesn't drift.
+		uint64_t now = MonotonicUs();
+		if (now < next) {
+			usleep(next - now);
+			continue;
+		}
+		next += period;
+
+		// Published first, so anyone who sees the new state also sees when it
+		// changed.
+		value = !value;
+		uint64_t count = (m_stim_record.load() + 1) & STIM_COUNT_MASK;
+		m_stim_record = (MonotonicUs() << STIM_COUNT_BITS) | count;
+		PushEvent(node, EV_KEY, code, value);
+		PushEvent(node, EV_SYN, SYN_REPORT, 0);
+	}
+}
+
+int FakeEvdevIO::NumNodes() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_nodes.size();
+}
+
+int FakeEvdevIO::Open(int node) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (node < 0 || node >= (int)m_nodes.size()) {
+		errno = ENOENT;
+		return -1;
+	}
+	return FAKE_FD_BASE + node;
+}
+
+int FakeEvdevIO::Close(int fd) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return Node(fd) ? 0 : -1;
+}
+
+static int CopyOut(void *arg, unsigned int size, const void *data, unsigned int len) {
+	if (len > size) len = size;
+	memcpy(arg, data, len);
+	return len;
+}
+
+int FakeEvdevIO::Ioctl(int fd, unsigned long request, void *arg) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	fake_node *n = Node(fd);
+	if (!n) return -1;
+
+	unsigned int nr = _IOC_NR(request);
+	unsigned int size = _IOC_SIZE(request);
+	if (_IOC_TYPE(request) != 'E') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (_IOC_DIR(request) == _IOC_READ) {
+		if (request == EVIOCGID)
+			return CopyOut(arg, size, &n->id, sizeof(n->id)) ? 0 : -1;
+		if (nr == _IOC_NR(EVIOCGNAME(0)))
+			return CopyOut(arg, size, n->name.c_str(), n->name.size() + 1);
+		if (nr == _IOC_NR(EVIOCGPHYS(0)))
+			return CopyOut(arg, size, n->phys.c_str(), n->phys.size() + 1);
+		if (nr == _IOC_NR(EVIOCGKEY(0)))
+			return CopyOut(arg, size, n->key_state, sizeof(n->key_state));
+		if (nr >= _IOC_NR(EVIOCGBIT(0, 0)) && nr < _IOC_NR(EVIOCGBIT(EV_CNT, 0))) {
+			switch (nr - _IOC_NR(EVIOCGBIT(0, 0))) {
+				case EV_KEY:
+					return CopyOut(arg, size, n->caps.key, sizeof(n->caps.key));
+				case EV_ABS:
+					return CopyOut(arg, size, n->caps.abs, sizeof(n->caps.abs));
+				case EV_REL:
+					return CopyOut(arg, size, n->caps.rel, sizeof(n->caps.rel));
+				case EV_FF:
+					return CopyOut(arg, size, n->caps.ff, sizeof(n->caps.ff));
+				default:
+					memset(arg, 0, size);
+					return 0;
+			}
+		}
+		if (nr >= _IOC_NR(EVIOCGABS(0)) && nr < _IOC_NR(EVIOCGABS(ABS_CNT)))
+			return CopyOut(arg, size, &n->caps.absinfo[nr - _IOC_NR(EVIOCGABS(0))], sizeof(input_absinfo)) ? 0 : -1;
+	} else if (_IOC_DIR(request) == _IOC_WRITE) {
+		if (request == EVIOCSFF) {
+			ff_effect *effect = (ff_effect*)arg;
+			if (effect->id < 0)
+				effect->id = n->next_effect++;
+			return 0;
+		}
+		if (request == EVIOCRMFF || request == EVIOCSCLOCKID)
+			return 0;
+		if (nr >= _IOC_NR(EVIOCSABS(0)) && nr < _IOC_NR(EVIOCSABS(ABS_CNT))) {
+			input_absinfo *info = (input_absinfo*)arg;
+			input_absinfo &dst = n->caps.absinfo[nr - _IOC_NR(EVIOCSABS(0))];
+			dst.fuzz = info->fuzz;
+			dst.flat = info->flat;
+			return 0;
+		}
+	}
+
+	// Uniq and anything else not supported, like a device without it.
+	errno = ENOENT;
+	return -1;
+}
+
+ssize_t FakeEvdevIO::Read(int fd, void *buf, size_t len) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	fake_node *n = Node(fd);
+	if (!n) return -1;
+
+	size_t count = len / sizeof(input_event);
+	if (n->events.empty() || !count) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (count > n->events.size())
+		count = n->events.size();
+	input_event *out = (input_event*)buf;
+	for (size_t i = 0; i < count; i++) {
+		out[i] = n->events.front();
+		n->events.pop_front();
+	}
+	return count * sizeof(input_event);
+}
+
+ssize_t FakeEvdevIO::Write(int fd, const void *buf, size_t len) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	// Force feedback plays/stops.  Nothing to do but accept them.
+	return Node(fd) ? (ssize_t)len : -1;
+}
@@ -0,0 +1,137 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2015  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "Global.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "Linux/bitmaskros.h"
+
+// Everything the constructors need to know about a device.  Identical
+// hardware reports identical capabilities, so the bitmaps and axis ranges
+// are cached by bus/vendor/product/version and each kind of device is only
+// fully probed once.
+struct evdev_caps {
+	uint8_t key[nUcharsForNBits(KEY_CNT)];
+	uint8_t abs[nUcharsForNBits(ABS_CNT)];
+	uint8_t rel[nUcharsForNBits(REL_CNT)];
+	uint8_t ff[nUcharsForNBits(FF_CNT)];
+	input_absinfo absinfo[ABS_CNT];
+};
+
+// Event time in MonotonicUs() units.  Devices are set to CLOCK_MONOTONIC
+// when they're opened, so the two are comparable.
+static inline u64 EvdevEventTime(const input_event &ev) {
+	return (u64)ev.time.tv_sec * 1000000 + ev.time.tv_usec;
+}
+
+// All access to /dev/input goes through this, so enumeration and the evdev
+// devices can be run against something other than real hardware.  Same
+// semantics as the system calls, including -1 and errno on failure.
+class EvdevIO {
+	public:
+		virtual ~EvdevIO() {}
+
+		// Number of event nodes to try opening.
+		virtual int NumNodes() = 0;
+		// Opens /dev/input/event<node> non-blocking, read/write.
+		virtual int Open(int node) = 0;
+		virtual int Close(int fd) = 0;
+		virtual int Ioctl(int fd, unsigned long request, void *arg) = 0;
+		virtual ssize_t Read(int fd, void *buf, size_t len) = 0;
+		virtual ssize_t Write(int fd, const void *buf, size_t len) = 0;
+};
+
+// Leaves 48 bits of microseconds for the time, which is years of uptime.
+#define STIM_COUNT_BITS 16
+#define STIM_COUNT_MASK ((1ULL << STIM_COUNT_BITS) - 1)
+
+// Simulated device tree.  Devices get fds that only mean something to this,
+// answer the ioctls enumeration and the devices use, and read back whatever
+// events were pushed to them.
+class FakeEvdevIO : public EvdevIO {
+	struct fake_node {
+		input_id id;
+		std::string name;
+		std::string phys;
+		evdev_caps caps;
+		uint8_t key_state[nUcharsForNBits(KEY_CNT)];
+		std::deque<input_event> events;
+		int16_t next_effect;
+	};
+
+	std::mutex m_lock;
+	std::vector<fake_node*> m_nodes;
+
+	fake_node *Node(int fd);
+
+	// Stimulus: a button toggled at a fixed rate, to measure latency through
+	// the whole plugin against.
+	std::thread m_stim_thread;
+	std::atomic<bool> m_stim_stop;
+	// Transitions so far in the low bits, and when the last one happened in
+	// the rest.  One word, so the two are always read together.
+	std::atomic<uint64_t> m_stim_record;
+
+	void RunStimulus(int node, uint16_t code, int hz);
+
+	public:
+		FakeEvdevIO();
+		~FakeEvdevIO();
+
+		// Returns the new device's node.
+		int AddDevice(const input_id &id, const char *name, const evdev_caps &caps);
+		// Adds count devices, cycling through a couple of pads, a keyboard and
+		// a mouse, so some share capabilities and some don't.
+		void AddDevices(int count);
+		// Queues an event and updates the state the device reports.  End each
+		// packet with EV_SYN/SYN_REPORT, like the kernel.  Overflowing the
+		// queue drops it and reports SYN_DROPPED, also like the kernel.
+		void PushEvent(int node, uint16_t type, uint16_t code, int32_t value);
+		// Toggles key code on node hz times a second, until destroyed.
+		void StartStimulus(int node, uint16_t code, int hz);
+		// Number of stimulus transitions so far, modulo 1 << STIM_COUNT_BITS,
+		// and when the last one happened, in MonotonicUs() time.  The state
+		// change is pushed after both are updated.
+		void GetStimulus(uint32_t *transitions, uint64_t *timeUs);
+
+		int NumNodes();
+		int Open(int node);
+		int Close(int fd);
+		int Ioctl(int fd, unsigned long request, void *arg);
+		ssize_t Read(int fd, void *buf, size_t len);
+		ssize_t Write(int fd, const void *buf, size_t len);
+};
+
+extern EvdevIO *evdev_io;
+
+// Picks the backend the first time it's called.  Setting LILYPAD_FAKE_EVDEV
+// to a device count uses a FakeEvdevIO with that many devices instead of
+// /dev/input.  Must be called before any evdev devices are created.
+void InitEvdevIO();
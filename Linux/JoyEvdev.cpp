@@ -18,9 +18,17 @@
 #include "Global.h"
 #include "InputManager.h"
 #include "Linux/JoyEvdev.h"
-#include "Linux/bitmaskros.h"
+#include "Linux/KeyboardMouse.h"
+#include "DeviceEnumerator.h"
+#include "Stats.h"
+#include "Log.h"
 
-JoyEvdev::JoyEvdev(int fd, bool ds3, const wchar_t *id) : Device(LNX_JOY, OTHER, id, id), m_fd(fd) {
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
+JoyEvdev::JoyEvdev(int fd, bool ds3, const wchar_t *id, const evdev_caps &caps) : Device(LNX_JOY, OTHER, id, id), m_fd(fd) {
 	// XXX LNX_JOY => DS3 or ???
 
 	m_abs.clear();
@@ -28,71 +36,99 @@ JoyEvdev::JoyEvdev(int fd, bool ds3, const wchar_t *id) : Device(LNX_JOY, OTHER,
 	m_rel.clear();
 	int last = 0;
 
-	uint8_t abs_bitmap[nUcharsForNBits(ABS_CNT)] = {0};
-	uint8_t btn_bitmap[nUcharsForNBits(KEY_CNT)] = {0};
-	uint8_t rel_bitmap[nUcharsForNBits(REL_CNT)] = {0};
-
 	// Add buttons
-	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(btn_bitmap)), btn_bitmap) >= 0) {
-		for (int bit = BTN_MISC; bit < KEY_CNT; bit++) {
-			if (testBit(bit, btn_bitmap)) {
-				AddPhysicalControl(PSHBTN, last, 0);
-				m_btn.push_back(bit);
-				last++;
-			}
+	for (int bit = BTN_MISC; bit < KEY_CNT; bit++) {
+		if (testBit(bit, caps.key)) {
+			AddPhysicalControl(PSHBTN, last, 0);
+			m_btn.push_back(bit);
+			last++;
 		}
 	}
 
 	// Add Absolute axis
-	if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bitmap)), abs_bitmap) >= 0) {
-		for (int bit = 0; bit < ABS_CNT; bit++) {
-			ControlType type = ABSAXIS; // FIXME DS3
+	for (int bit = 0; bit < ABS_CNT; bit++) {
+		ControlType type = ABSAXIS; // FIXME DS3
 
-			if (testBit(bit, abs_bitmap)) {
-				input_absinfo info;
-				if (ioctl(m_fd, EVIOCGABS(bit), &info) < 0) {
-					fprintf(stderr, "Invalid IOCTL EVIOCGID\n");
-					continue;
-				}
+		if (testBit(bit, caps.abs)) {
+			const input_absinfo &info = caps.absinfo[bit];
+
+			AddPhysicalControl(ABSAXIS, last, 0);
+			last++;
+			if (std::abs(info.value - 127) < 2) {
+				LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "HALF Axis info %d=>%d, current %d, flat %d, resolution %d\n", info.minimum, info.maximum, info.value, info.flat, info.resolution);
 
+				// Half axis must be split into 2 parts...
 				AddPhysicalControl(ABSAXIS, last, 0);
 				last++;
-				if (std::abs(info.value - 127) < 2) {
-					fprintf(stderr, "HALF Axis info %d=>%d, current %d, flat %d, resolution %d\n", info.minimum, info.maximum, info.value, info.flat, info.resolution);
 
-					// Half axis must be split into 2 parts...
-					AddPhysicalControl(ABSAXIS, last, 0);
-					last++;
+				m_abs.push_back(abs_info(bit, info.minimum, info.value, type, true));
+				m_abs.push_back(abs_info(bit, info.value, info.maximum, type));
+			} else {
+				LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "FULL Axis info %d=>%d, current %d, flat %d, resolution %d\n", info.minimum, info.maximum, info.value, info.flat, info.resolution);
 
-					m_abs.push_back(abs_info(bit, info.minimum, info.value, type));
-					m_abs.push_back(abs_info(bit, info.value, info.maximum, type));
-				} else {
-					fprintf(stderr, "FULL Axis info %d=>%d, current %d, flat %d, resolution %d\n", info.minimum, info.maximum, info.value, info.flat, info.resolution);
-
-					m_abs.push_back(abs_info(bit, info.minimum, info.maximum, type));
-				}
+				m_abs.push_back(abs_info(bit, info.minimum, info.maximum, type));
+			}
+			for (size_t idx = m_abs.size(); idx-- > 0 && m_abs[idx].code == bit;) {
+				m_abs[idx].fuzz = info.fuzz;
+				m_abs[idx].flat = info.flat;
 			}
 		}
 	}
 
 	// Add relative axis
-	if (ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel_bitmap)), rel_bitmap) >= 0) {
-		for (int bit = 0; bit < REL_CNT; bit++) {
-			if (testBit(bit, rel_bitmap)) {
-				AddPhysicalControl(RELAXIS, last, last);
-				m_rel.push_back(bit);
-				last++;
+	for (int bit = 0; bit < REL_CNT; bit++) {
+		if (testBit(bit, caps.rel)) {
+			AddPhysicalControl(RELAXIS, last, last);
+			m_rel.push_back(bit);
+			last++;
 
-				fprintf(stderr, "Add relative nb %d\n", bit);
-			}
+			LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "Add relative nb %d\n", bit);
 		}
 	}
 
-	fprintf(stderr, "New device created. Found axe:%d, buttons:%d, m_rel:%d\n\n", m_abs.size(), m_btn.size(), m_rel.size());
+	// Lookup tables for the reader, so it doesn't have to search per event.
+	m_btn_map.assign(KEY_CNT, -1);
+	for (size_t idx = 0; idx < m_btn.size(); idx++)
+		m_btn_map[m_btn[idx]] = idx;
+	m_abs_map.assign(ABS_CNT, -1);
+	for (size_t idx = m_abs.size(); idx-- > 0;)
+		m_abs_map[m_abs[idx].code] = idx;
+
+	size_t staged = m_btn.size() + m_abs.size();
+	m_staged.assign(staged, 0);
+	m_is_staged.assign(staged, 0);
+	m_dirty.reserve(staged);
+	m_dropped = false;
+
+	// Add force feedback.  Effect types are registered in the same order as m_ff.
+	memset(ps2Vibration, 0, sizeof(ps2Vibration));
+	m_ff.clear();
+	bool rumble = testBit(FF_RUMBLE, caps.ff);
+	bool constant = testBit(FF_CONSTANT, caps.ff);
+	if (rumble || constant) {
+		AddFFAxis(L"Big Motor", 0);
+		AddFFAxis(L"Small Motor", 1);
+	}
+	if (rumble) {
+		AddFFEffectType(L"Rumble", L"Rumble", EFFECT_CONSTANT);
+		m_ff.push_back(ff_effect_slot{FF_RUMBLE, -1, {0, 0}, false});
+	}
+	if (constant) {
+		AddFFEffectType(L"Constant Effect", L"Constant", EFFECT_CONSTANT);
+		m_ff.push_back(ff_effect_slot{FF_CONSTANT, -1, {0, 0}, false});
+	}
+
+	LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "New device created. Found axe:%d, buttons:%d, m_rel:%d, ff:%d\n\n", m_abs.size(), m_btn.size(), m_rel.size(), m_ff.size());
 }
 
 JoyEvdev::~JoyEvdev() {
-	close(m_fd);
+	RestoreAbsFilters();
+	StopEffects();
+	for (size_t i = 0; i < m_ff.size(); i++) {
+		if (m_ff[i].id >= 0)
+			evdev_io->Ioctl(m_fd, EVIOCRMFF, (void*)(intptr_t)m_ff[i].id);
+	}
+	evdev_io->Close(m_fd);
 }
 
 int JoyEvdev::Activate(InitInfo* args) {
@@ -101,51 +137,296 @@ int JoyEvdev::Activate(InitInfo* args) {
 	uint16_t size = m_abs.size()+m_rel.size()+m_btn.size();
 	memset(physicalControlState, 0, sizeof(int)*size);
 
+	ProgramAbsFilters();
+
+	// Anything queued from before activation is stale.  Start from the
+	// kernel's view of the device instead of assuming everything's released.
+	DiscardPacket();
+	m_dropped = false;
+	Resync();
+
 	active = 1;
 	return 1;
 }
 
+void JoyEvdev::Deactivate() {
+	// Effects stay uploaded until the device is destroyed, so reactivating
+	// doesn't cost another EVIOCSFF.
+	StopEffects();
+	memset(ps2Vibration, 0, sizeof(ps2Vibration));
+	RestoreAbsFilters();
+
+	FreeState();
+	active = 0;
+}
+
+int JoyEvdev::WriteFF(uint16_t code, int32_t value) {
+	struct input_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EV_FF;
+	ev.code = code;
+	ev.value = value;
+	CountStat(STAT_FF_WRITES);
+	return evdev_io->Write(m_fd, &ev, sizeof(ev)) == sizeof(ev);
+}
+
+int JoyEvdev::UploadEffect(ff_effect_slot &slot, const int *level) {
+	struct ff_effect effect;
+	memset(&effect, 0, sizeof(effect));
+	effect.type = slot.type;
+	// -1 asks the kernel for a new effect, otherwise the existing one is modified in place.
+	effect.id = slot.id;
+	effect.direction = 0x4000;
+	if (slot.type == FF_RUMBLE) {
+		effect.u.rumble.strong_magnitude = (uint16_t)level[0];
+		effect.u.rumble.weak_magnitude = (uint16_t)level[1];
+	} else {
+		// Constant force only has a single signed level, driven by the first axis.
+		effect.u.constant.level = (int16_t)(level[0] / 2);
+	}
+	// Length of 0 plays until stopped.
+	effect.replay.length = 0;
+	effect.replay.delay = 0;
+
+	CountStat(STAT_FF_WRITES);
+	if (evdev_io->Ioctl(m_fd, EVIOCSFF, &effect) < 0) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCSFF\n");
+		return 0;
+	}
+	slot.id = effect.id;
+	slot.level[0] = level[0];
+	slot.level[1] = level[1];
+	return 1;
+}
+
+void JoyEvdev::SetEffectLevel(ff_effect_slot &slot, const int *level) {
+	if (!level[0] && !level[1]) {
+		if (slot.id < 0)
+			return;
+		// Stop it, and zero the uploaded copy too, so if the stop is lost
+		// the device isn't left rumbling at the old level.
+		if (slot.playing && WriteFF(slot.id, 0))
+			slot.playing = false;
+		if (slot.level[0] || slot.level[1])
+			UploadEffect(slot, level);
+		return;
+	}
+	// Only rewrite the kernel's copy when the level actually changed.
+	if (slot.id < 0 || level[0] != slot.level[0] || level[1] != slot.level[1]) {
+		if (!UploadEffect(slot, level))
+			return;
+	}
+	if (!slot.playing && WriteFF(slot.id, 1))
+		slot.playing = true;
+}
+
+void JoyEvdev::StopEffects() {
+	for (size_t i = 0; i < m_ff.size(); i++) {
+		if (m_ff[i].playing) {
+			WriteFF(m_ff[i].id, 0);
+			m_ff[i].playing = false;
+		}
+	}
+}
+
+void JoyEvdev::SetEffects(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force) {
+	ps2Vibration[port][slot][motor] = force;
+	if (m_ff.empty())
+		return;
+
+	// At most one rumble and one constant effect.
+	int level[2][2];
+	memset(level, 0, sizeof(level));
+	for (int p=0; p<2; p++) {
+		for (int s=0; s<4; s++) {
+			for (int i=0; i<pads[p][s].numFFBindings; i++) {
+				ForceFeedbackBinding *ffb = &pads[p][s].ffBindings[i];
+				if ((unsigned int)ffb->effectIndex >= m_ff.size()) continue;
+				for (int k=0; k<2 && k<numFFAxes; k++) {
+					level[ffb->effectIndex][k] += (int)((ffb->axes[k].force * (__int64)ps2Vibration[p][s][ffb->motor]) / 255);
+				}
+			}
+		}
+	}
+
+	for (size_t e = 0; e < m_ff.size(); e++) {
+		for (int k=0; k<2; k++) {
+			if (m_ff[e].type == FF_RUMBLE)
+				level[e][k] = abs(level[e][k]);
+			level[e][k] = std::max(-65535, std::min(65535, level[e][k]));
+		}
+		SetEffectLevel(m_ff[e], level[e]);
+	}
+}
+
+// Plays just the one binding at force, for testing it from the config
+// dialog.  Leaves the pads' vibration alone, and 0 stops the effect.
+void JoyEvdev::SetEffect(ForceFeedbackBinding *binding, unsigned char force) {
+	if ((unsigned int)binding->effectIndex >= m_ff.size())
+		return;
+	ff_effect_slot &slot = m_ff[binding->effectIndex];
+	int level[2] = {0, 0};
+	for (int k=0; k<2 && k<numFFAxes; k++) {
+		level[k] = (int)((binding->axes[k].force * (__int64)force) / 255);
+		if (slot.type == FF_RUMBLE)
+			level[k] = abs(level[k]);
+		level[k] = std::max(-65535, std::min(65535, level[k]));
+	}
+	SetEffectLevel(slot, level);
+}
+
+void JoyEvdev::SetControl(int index, int32_t value) {
+	int btn_nb = m_btn.size();
+	if (index < btn_nb) {
+		// Autorepeat (2) is still just down.
+		physicalControlState[index] = value ? FULLY_DOWN : 0;
+		return;
+	}
+	abs_info &abs = m_abs[index - btn_nb];
+	// XXX strict or not ?
+	if ((value >= abs.min) && (value <= abs.max))
+		physicalControlState[index] = abs.scale(value);
+}
+
+void JoyEvdev::StageEvent(int index, int32_t value) {
+	m_staged[index] = value;
+	if (!m_is_staged[index]) {
+		m_is_staged[index] = 1;
+		m_dirty.push_back(index);
+	}
+}
+
+void JoyEvdev::CommitPacket() {
+	for (size_t i = 0; i < m_dirty.size(); i++) {
+		int index = m_dirty[i];
+		SetControl(index, m_staged[index]);
+		m_is_staged[index] = 0;
+	}
+	m_dirty.clear();
+}
+
+void JoyEvdev::DiscardPacket() {
+	for (size_t i = 0; i < m_dirty.size(); i++)
+		m_is_staged[m_dirty[i]] = 0;
+	m_dirty.clear();
+}
+
+void JoyEvdev::Resync() {
+	uint8_t key_state[nUcharsForNBits(KEY_CNT)] = {0};
+	if (evdev_io->Ioctl(m_fd, EVIOCGKEY(sizeof(key_state)), key_state) >= 0) {
+		for (size_t idx = 0; idx < m_btn.size(); idx++)
+			SetControl(idx, testBit(m_btn[idx], key_state));
+	} else {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGKEY\n");
+	}
+
+	input_absinfo info;
+	int last_code = -1;
+	for (size_t idx = 0; idx < m_abs.size(); idx++) {
+		// Both halves of a split axis share one query.
+		if (m_abs[idx].code != last_code) {
+			if (evdev_io->Ioctl(m_fd, EVIOCGABS(m_abs[idx].code), &info) < 0) {
+				LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGABS\n");
+				last_code = -1;
+				continue;
+			}
+			last_code = m_abs[idx].code;
+		}
+		SetControl(m_btn.size() + idx, info.value);
+	}
+}
+
+void JoyEvdev::ProgramAbsFilters() {
+	// Smallest dead zone bound to each axis, BASE_SENSITIVITY is full deflection.
+	std::vector<int> dead_zone(m_abs.size(), BASE_SENSITIVITY+1);
+	int btn_nb = m_btn.size();
+	for (int port = 0; port < 2; port++) {
+		for (int slot = 0; slot < 4; slot++) {
+			for (int i = 0; i < pads[port][slot].numBindings; i++) {
+				Binding *b = pads[port][slot].bindings + i;
+				int idx = virtualControls[b->controlIndex].physicalControlIndex - btn_nb;
+				if (idx < 0 || idx >= (int)m_abs.size()) continue;
+				dead_zone[idx] = std::min(dead_zone[idx], std::max(b->deadZone, 0));
+			}
+		}
+	}
+
+	for (size_t idx = 0; idx < m_abs.size(); idx++) {
+		// Both halves of a split axis share the kernel's settings.
+		int dz = dead_zone[idx];
+		while (idx+1 < m_abs.size() && m_abs[idx+1].code == m_abs[idx].code)
+			dz = std::min(dz, dead_zone[++idx]);
+		if (dz > BASE_SENSITIVITY) continue;
+
+		input_absinfo info;
+		if (evdev_io->Ioctl(m_fd, EVIOCGABS(m_abs[idx].code), &info) < 0) continue;
+
+		int64_t half_range = ((int64_t)info.maximum - info.minimum) / 2;
+		// Flat is what joydev and other clients treat as centered.  Fuzz is what
+		// the kernel actually filters on, so keep that well inside the dead zone
+		// and never below what the driver asked for.
+		info.flat = (int32_t)(half_range * dz / BASE_SENSITIVITY);
+		info.fuzz = std::max(m_abs[idx].fuzz, info.flat / 8);
+		if (evdev_io->Ioctl(m_fd, EVIOCSABS(m_abs[idx].code), &info) < 0)
+			LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCSABS\n");
+	}
+}
+
+void JoyEvdev::RestoreAbsFilters() {
+	int last_code = -1;
+	for (size_t idx = 0; idx < m_abs.size(); idx++) {
+		if (m_abs[idx].code == last_code) continue;
+		last_code = m_abs[idx].code;
+
+		input_absinfo info;
+		if (evdev_io->Ioctl(m_fd, EVIOCGABS(m_abs[idx].code), &info) < 0) continue;
+		if (info.fuzz == m_abs[idx].fuzz && info.flat == m_abs[idx].flat) continue;
+		info.fuzz = m_abs[idx].fuzz;
+		info.flat = m_abs[idx].flat;
+		evdev_io->Ioctl(m_fd, EVIOCSABS(m_abs[idx].code), &info);
+	}
+}
+
 int JoyEvdev::Update() {
-    struct input_event events[32];
+	struct input_event events[32];
 	int len;
 	int status = 0;
-	//fprintf(stderr, "Update was called\n");
-	
+
 	// Do a big read to reduce kernel validation
-    while ((len = read(m_fd, events, (sizeof events))) > 0) {
+	while ((len = evdev_io->Read(m_fd, events, (sizeof events))) > 0) {
 		int evt_nb = len / sizeof(input_event);
-		//fprintf(stderr, "Poll %d events available\n", evt_nb);
+		CountInputs(evt_nb);
 		for (int i = 0; i < evt_nb; i++) {
-			switch(events[i].type) {
-				case EV_ABS:
-					{
-						for (size_t idx = 0; idx < m_abs.size(); idx++) {
-							if (m_abs[idx].code == events[i].code) {
-								// XXX strict or not ?
-								if ((events[i].value >= m_abs[idx].min) && (events[i].value <= m_abs[idx].max)) {
-									// XXX FIX shitty api
-									int scale = m_abs[idx].scale(events[i].value);
-									fprintf(stderr, "axis value %d scaled to %d\n", events[i].value, scale);
-									physicalControlState[idx + m_btn.size()] = scale;
-									status = 1;
-								}
-							}
+			const input_event &ev = events[i];
+			switch (ev.type) {
+				case EV_SYN:
+					if (ev.code == SYN_REPORT) {
+						if (m_dropped) {
+							// Kernel buffer overflowed.  Deltas are useless now, so
+							// just ask for the current state.
+							m_dropped = false;
+							Resync();
+							status = 1;
+						} else if (!m_dirty.empty()) {
+							CommitPacket();
+							StampInput(EvdevEventTime(ev));
+							status = 1;
 						}
+					} else if (ev.code == SYN_DROPPED) {
+						DiscardPacket();
+						m_dropped = true;
 					}
 					break;
-				case EV_KEY: 
-					{
-						for (size_t idx = 0; idx < m_btn.size(); idx++) {
-							if (m_btn[idx] == events[i].code) {
-								fprintf(stderr, "Event KEY:%d detected with value %d\n", events[i].code, events[i].value);
-								physicalControlState[idx] = FULLY_DOWN * events[i].value;
-								status = 1;
-								break;
-							}
-						}
-
+				case EV_ABS:
+					if (!m_dropped && ev.code < ABS_CNT) {
+						for (int idx = m_abs_map[ev.code]; idx >= 0 && idx < (int)m_abs.size() && m_abs[idx].code == ev.code; idx++)
+							StageEvent(m_btn.size() + idx, ev.value);
 					}
 					break;
+				case EV_KEY:
+					if (!m_dropped && ev.code < KEY_CNT && m_btn_map[ev.code] >= 0)
+						StageEvent(m_btn_map[ev.code], ev.value);
+					break;
 				case EV_REL:
 					// XXX
 					break;
@@ -153,56 +434,179 @@ int JoyEvdev::Update() {
 					break;
 			}
 		}
-
 	}
 
 	return status;
 }
 
 
-static std::wstring CorrectJoySupport(int fd) {
-	struct input_id id;
-	if (ioctl(fd, EVIOCGID, &id) < 0) {
-		fprintf(stderr, "Invalid IOCTL EVIOCGID\n");
+static std::wstring CorrectJoySupport(int fd, input_id &id) {
+	if (evdev_io->Ioctl(fd, EVIOCGID, &id) < 0) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGID\n");
 		return L"";
 	}
 
 	char dev_name[128];
-	if (ioctl(fd, EVIOCGNAME(128), dev_name) < 0) {
-		fprintf(stderr, "Invalid IOCTL EVIOCGNAME\n");
+	if (evdev_io->Ioctl(fd, EVIOCGNAME(128), dev_name) < 0) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGNAME\n");
 		return L"";
 	}
 
-	fprintf(stderr, "Found input device => bustype:%x, vendor:%x, product:%x, version:%x\n", id.bustype, id.vendor, id.product, id.version);
-	fprintf(stderr, "\tName:%s\n", dev_name);
+	LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "Found input device => bustype:%x, vendor:%x, product:%x, version:%x\n", id.bustype, id.vendor, id.product, id.version);
+	LOG(LOGCAT_EVDEV, LOGLEVEL_DEBUG, "\tName:%s\n", dev_name);
 
 	std::string s(dev_name);
 	return std::wstring(s.begin(), s.end());
 }
 
+// Current value, fuzz and flat of each axis in caps.abs.  Axes that can't
+// be queried are dropped.
+static void ReadAbsState(int fd, evdev_caps &caps) {
+	for (int bit = 0; bit < ABS_CNT; bit++) {
+		if (!testBit(bit, caps.abs)) continue;
+		input_absinfo info;
+		if (evdev_io->Ioctl(fd, EVIOCGABS(bit), &info) < 0) {
+			LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGABS\n");
+			caps.abs[ucharIndexForBit(bit)] &= ~ucharValueForBit(bit);
+			continue;
+		}
+		caps.absinfo[bit].value = info.value;
+		caps.absinfo[bit].fuzz = info.fuzz;
+		caps.absinfo[bit].flat = info.flat;
+	}
+}
+
+static void ReadCaps(int fd, evdev_caps &caps) {
+	memset(&caps, 0, sizeof(caps));
+	evdev_io->Ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(caps.key)), caps.key);
+	evdev_io->Ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(caps.abs)), caps.abs);
+	evdev_io->Ioctl(fd, EVIOCGBIT(EV_REL, sizeof(caps.rel)), caps.rel);
+	evdev_io->Ioctl(fd, EVIOCGBIT(EV_FF, sizeof(caps.ff)), caps.ff);
+	for (int bit = 0; bit < ABS_CNT; bit++) {
+		if (testBit(bit, caps.abs) && evdev_io->Ioctl(fd, EVIOCGABS(bit), &caps.absinfo[bit]) < 0) {
+			LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGABS\n");
+			caps.abs[ucharIndexForBit(bit)] &= ~ucharValueForBit(bit);
+		}
+	}
+}
+
+// Only what identical hardware always reports the same way is kept:  the
+// bitmaps and each axis' range.  Value, fuzz and flat are per device, and
+// fuzz and flat may still be whatever a previous run programmed.
+static std::mutex caps_lock;
+static std::map<uint64_t, evdev_caps> caps_cache;
+
+static void GetCaps(int fd, const input_id &id, evdev_caps &caps) {
+	// Virtual devices tend to all be 0:0, so can't be told apart.
+	if (!id.vendor && !id.product) {
+		ReadCaps(fd, caps);
+		return;
+	}
+
+	uint64_t key = ((uint64_t)id.bustype << 48) | ((uint64_t)id.vendor << 32) | ((uint64_t)id.product << 16) | id.version;
+	bool cached = false;
+	{
+		std::lock_guard<std::mutex> lock(caps_lock);
+		std::map<uint64_t, evdev_caps>::iterator it = caps_cache.find(key);
+		if (it != caps_cache.end()) {
+			caps = it->second;
+			cached = true;
+		}
+	}
+	if (cached) {
+		ReadAbsState(fd, caps);
+		return;
+	}
+
+	// Probe unlocked, other threads may be doing the same.  Worst case, two
+	// identical devices both probe and the second result is dropped.
+	ReadCaps(fd, caps);
+	std::lock_guard<std::mutex> lock(caps_lock);
+	std::pair<std::map<uint64_t, evdev_caps>::iterator, bool> added = caps_cache.insert(std::make_pair(key, caps));
+	if (added.second) {
+		for (int bit = 0; bit < ABS_CNT; bit++) {
+			input_absinfo &info = added.first->second.absinfo[bit];
+			info.value = info.fuzz = info.flat = 0;
+		}
+	}
+}
+
+static Device *ProbeEvdev(int i) {
+	int fd = evdev_io->Open(i);
+	if (fd < 0) {
+		return 0;
+	}
+
+	input_id input;
+	std::wstring id = CorrectJoySupport(fd, input);
+	if (id.size() == 0) {
+		evdev_io->Close(fd);
+		return 0;
+	}
+
+	// Event times on the same clock as MonotonicUs(), for latency stats.
+	int clock = CLOCK_MONOTONIC;
+	evdev_io->Ioctl(fd, EVIOCSCLOCKID, &clock);
+
+	evdev_caps caps;
+	GetCaps(fd, input, caps);
+
+	Device *kbm = CreateEvdevKeyboardMouse(fd, id.c_str(), caps);
+	if (kbm) {
+		return kbm;
+	}
+
+	bool ds3 = id.find(L"PLAYSTATION(R)3") != std::string::npos;
+	if (ds3) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_INFO, "DS3 device detected !!!\n");
+	}
+	return new JoyEvdev(fd, ds3, id.c_str(), caps);
+}
+
 void EnumJoystickEvdev() {
 	// Technically it must be done with udev but another lib for 
 	// avoid a loop is too much for me (even if udev is mandatory
 	// so maybe later)
-	int found_devices = 0;
-	std::string input_root("/dev/input/event");
-	for (int i = 0; i < 32; i++) {
-		std::string dev = input_root + std::to_string(i);
+	InitEvdevIO();
+	const int num_nodes = evdev_io->NumNodes();
+	auto start = std::chrono::steady_clock::now();
 
-		int fd = open(dev.c_str(), O_RDWR | O_NONBLOCK);
-		if (fd < 0) {
-			continue;
-		}
+	// Most of the time is spent waiting on the kernel, so probe a few nodes
+	// at once.  Results are still queued in node order, so identically named
+	// devices keep getting the same bindings.
+	std::atomic<int> next(0);
+	std::mutex lock;
+	std::vector<Device*> found(num_nodes, (Device*)0);
+	std::vector<char> probed(num_nodes, 0);
+	int queued = 0;
 
-		std::wstring id = CorrectJoySupport(fd);
-		if (id.size() != 0) {
-			bool ds3 = id.find(L"PLAYSTATION(R)3") != std::string::npos;
-			if (ds3) {
-				fprintf(stderr, "DS3 device detected !!!\n");
+	auto worker = [&]() {
+		int i;
+		while (!EnumerationCancelled() && (i = next++) < num_nodes) {
+			Device *dev = ProbeEvdev(i);
+
+			std::lock_guard<std::mutex> guard(lock);
+			found[i] = dev;
+			probed[i] = true;
+			for (; queued < num_nodes && probed[queued]; queued++) {
+				if (found[queued])
+					QueueEnumeratedDevice(found[queued]);
 			}
-			dm->AddDevice(new JoyEvdev(fd, ds3, id.c_str()));
-		} else if (fd >= 0)
-			close(fd);
+		}
+	};
+
+	std::thread pool[4];
+	for (int i = 0; i < 4; i++)
+		pool[i] = std::thread(worker);
+	for (int i = 0; i < 4; i++)
+		pool[i].join();
+
+	// Only left over when cancelled part way.
+	for (int i = queued; i < num_nodes; i++) {
+		if (probed[i])
+			delete found[i];
 	}
 
+	long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	LOG(LOGCAT_EVDEV, LOGLEVEL_INFO, "Probed %d evdev nodes in %lld ms\n", num_nodes, ms);
 }
@@ -23,55 +23,117 @@
 #include <fcntl.h>
 #include <linux/input.h>
 
+#include "Linux/EvdevIO.h"
+
+// Fixed point precision of abs_info::mul.
+#define ABS_SCALE_SHIFT 24
+
 struct abs_info {
 	uint16_t code;
 	int32_t min;
 	int32_t max;
 
-	int32_t factor;
-	int32_t translation;
+	// Half axes count from max down to min, so pushing away from the center
+	// is always positive.
+	bool invert;
+
+	// Output is ((value - min) * mul >> ABS_SCALE_SHIFT) + out_min.  Precomputed
+	// so any range reported by the driver can be used without a divide.
+	int32_t out_min;
+	int64_t mul;
+
+	// Driver's own values, restored when we're done with the device.
+	int32_t fuzz;
+	int32_t flat;
 
-	abs_info(int32_t _code, int32_t _min, int32_t _max, ControlType type) : code(_code), min(_min), max(_max) {
-		translation = 0;
+	abs_info(int32_t _code, int32_t _min, int32_t _max, ControlType type, bool _invert = false) : code(_code), min(_min), max(_max), invert(_invert) {
 		// Note: ABSAXIS ranges from -64K to 64K
 		// Note: PSHBTN ranges from 0 to 64K
-		if ((min == 0) && (max == 255)) {
-			if (type == ABSAXIS) {
-				translation = 128;
-				factor = FULLY_DOWN/128;
-			} else {
-				factor = FULLY_DOWN/256;
-			}
-		} else if ((min == -1) && (max == 1)) {
-			factor = FULLY_DOWN;
-		} else if ((min == 0) && (std::abs(max - 127) < 2)) {
-			translation = 64;
-			factor = -FULLY_DOWN/64;
-		} else if ((max == 255) && (std::abs(min - 127) < 2)) {
-			translation = 64+128;
-			factor = FULLY_DOWN/64;
-		} else {
-			fprintf(stderr, "Scale not supported\n");
-			factor = 0;
+		int64_t out_range = FULLY_DOWN;
+		out_min = 0;
+		if (type == ABSAXIS) {
+			out_range = 2 * FULLY_DOWN;
+			out_min = -FULLY_DOWN;
 		}
+		int64_t range = (int64_t)max - min;
+		if (range <= 0)
+			range = 1;
+		mul = ((out_range << ABS_SCALE_SHIFT) + range / 2) / range;
+		fuzz = 0;
+		flat = 0;
 	}
 
-	int scale(int32_t value) {
-		return (value - translation) * factor;
+	int scale(int32_t value) const {
+		int64_t v = invert ? (int64_t)max - value : (int64_t)value - min;
+		return (int)(((v * mul + (1 << (ABS_SCALE_SHIFT - 1))) >> ABS_SCALE_SHIFT) + out_min);
 	}
 };
 
+// One kernel force feedback effect.  Uploaded with EVIOCSFF the first time it's
+// needed, then started/stopped with EV_FF writes.  Parameters are only rewritten
+// (in place, same id) when the level actually changes.
+struct ff_effect_slot {
+	uint16_t type;
+	int16_t id;
+	int level[2];
+	bool playing;
+};
+
 class JoyEvdev : public Device {
 	int m_fd;
 	std::vector<abs_info> m_abs;
 	std::vector<uint16_t> m_btn;
 	std::vector<uint16_t> m_rel;
 
+	// Maps evdev codes to an index in m_btn/m_abs, -1 when unused.  Half axes
+	// take two consecutive m_abs entries with the same code.
+	std::vector<int16_t> m_btn_map;
+	std::vector<int16_t> m_abs_map;
+
+	// Events are staged until SYN_REPORT, so a packet is applied all at once and
+	// only the last value of each control in it is used.  Indices match
+	// physicalControlState.
+	std::vector<int32_t> m_staged;
+	std::vector<uint8_t> m_is_staged;
+	std::vector<uint16_t> m_dirty;
+	// Set on SYN_DROPPED.  Everything up to the next SYN_REPORT is thrown away,
+	// then the whole state is queried from the kernel.
+	bool m_dropped;
+
+	void StageEvent(int index, int32_t value);
+	void CommitPacket();
+	void DiscardPacket();
+	void SetControl(int index, int32_t value);
+	void Resync();
+
+	// Sets each bound axis' flat/fuzz from its smallest binding dead zone, so
+	// the kernel drops jitter before it's queued.  Restore puts the driver's
+	// values back.
+	void ProgramAbsFilters();
+	void RestoreAbsFilters();
+
+	// Indexed the same as ffEffectTypes.
+	std::vector<ff_effect_slot> m_ff;
+	// Cached last vibration values by pad and motor.
+	// Need this, as only one value is changed at a time.
+	int ps2Vibration[2][4][2];
+
+	int WriteFF(uint16_t code, int32_t value);
+	int UploadEffect(ff_effect_slot &slot, const int *level);
+	void SetEffectLevel(ff_effect_slot &slot, const int *level);
+	void StopEffects();
+
 	public:
-		JoyEvdev(int fd, bool ds3, const wchar_t *id);
+		JoyEvdev(int fd, bool ds3, const wchar_t *id, const evdev_caps &caps);
 		~JoyEvdev();
 		int Activate(InitInfo* args);
+		void Deactivate();
 		int Update();
+
+		void SetEffects(unsigned char port, unsigned int slot, unsigned char motor, unsigned char force);
+		void SetEffect(ForceFeedbackBinding *binding, unsigned char force);
 };
 
+// Probes /dev/input on a few threads, queueing devices with
+// QueueEnumeratedDevice() in node order.
 void EnumJoystickEvdev();
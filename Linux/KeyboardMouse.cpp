@@ -16,16 +16,31 @@
  */
 
 #include "Linux/KeyboardMouse.h"
+#include "Linux/JoyEvdev.h"
+#include "Config.h"
+#include "Log.h"
+#include "Stats.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <linux/input.h>
 
 // actually it is even more but it is enough to distinguish different key
 #define MAX_KEYCODE (0xFF)
 
+static DeviceLayout keyboardLayout;
+
 LinuxKeyboard::LinuxKeyboard() :
 	Device(LNX_KEYBOARD, KEYBOARD, L"displayName", L"instanceID", L"deviceID")
 {
-	for (int i=0; i<MAX_KEYCODE; i++) {
-		AddPhysicalControl(PSHBTN, i, i);
+	if (!UseLayout(&keyboardLayout)) {
+		for (int i=0; i<MAX_KEYCODE; i++) {
+			AddPhysicalControl(PSHBTN, i, i);
+		}
+		SaveLayout(&keyboardLayout);
 	}
+	EnableSparseState();
 }
 
 int LinuxKeyboard::Activate(InitInfo* args) {
@@ -46,6 +61,7 @@ int LinuxKeyboard::Activate(InitInfo* args) {
 #endif
 	// Every button released
 	memset(physicalControlState, 0, sizeof(int)*MAX_KEYCODE);
+	MarkAllChanged();
 
 	return 1;
 }
@@ -56,11 +72,11 @@ int LinuxKeyboard::Update() {
 	while (R_GetQueuedKeyEvent(&event)) {
 		switch (event.evt) {
 			case KeyPress:
-				physicalControlState[MAX_KEYCODE & event.key] = FULLY_DOWN;
+				SetButtonState(MAX_KEYCODE & event.key, FULLY_DOWN);
 				status = 1;
 				break;
 			case KeyRelease:
-				physicalControlState[MAX_KEYCODE & event.key] = 0;
+				SetButtonState(MAX_KEYCODE & event.key, 0);
 				status = 1;
 				break;
 			default:
@@ -76,3 +92,235 @@ int LinuxKeyboard::Update() {
 void EnumLnx() {
 	dm->AddDevice(new LinuxKeyboard());
 }
+
+// Reads the pressed state of every key in keys from the kernel.
+static void ReadKeyState(int fd, const std::vector<uint16_t> &keys, int *state) {
+	uint8_t key_state[nUcharsForNBits(KEY_CNT)] = {0};
+	if (evdev_io->Ioctl(fd, EVIOCGKEY(sizeof(key_state)), key_state) < 0) {
+		LOG(LOGCAT_EVDEV, LOGLEVEL_ERROR, "Invalid IOCTL EVIOCGKEY\n");
+		return;
+	}
+	for (size_t idx = 0; idx < keys.size(); idx++)
+		state[idx] = testBit(keys[idx], key_state) ? FULLY_DOWN : 0;
+}
+
+EvdevKeyboard::EvdevKeyboard(int fd, const wchar_t *displayName, const wchar_t *instanceID, wchar_t *productID, const evdev_caps &caps) :
+	Device(LNX_EVDEV, KEYBOARD, displayName, instanceID, productID), m_fd(fd), m_dropped(false)
+{
+	m_key_map.assign(KEY_CNT, -1);
+	for (int bit = 1; bit < KEY_CNT; bit++) {
+		if (testBit(bit, caps.key)) {
+			m_key_map[bit] = m_keys.size();
+			m_keys.push_back(bit);
+			AddPhysicalControl(PSHBTN, bit, 0);
+		}
+	}
+}
+
+EvdevKeyboard::~EvdevKeyboard() {
+	evdev_io->Close(m_fd);
+}
+
+wchar_t *EvdevKeyboard::GetPhysicalControlName(PhysicalControl *c) {
+	static wchar_t name[20];
+	wsprintfW(name, L"Key %i", c->id);
+	return name;
+}
+
+void EvdevKeyboard::Resync() {
+	ReadKeyState(m_fd, m_keys, physicalControlState);
+}
+
+int EvdevKeyboard::Activate(InitInfo* args) {
+	AllocState();
+
+	// Drop anything queued while inactive, then start from the real state.
+	struct input_event events[32];
+	while (evdev_io->Read(m_fd, events, sizeof(events)) > 0);
+	m_dropped = false;
+	Resync();
+
+	active = 1;
+	return 1;
+}
+
+int EvdevKeyboard::Update() {
+	struct input_event events[32];
+	int len;
+	int status = 0;
+	bool changed = false;
+
+	while ((len = evdev_io->Read(m_fd, events, (sizeof events))) > 0) {
+		int evt_nb = len / sizeof(input_event);
+		CountInputs(evt_nb);
+		for (int i = 0; i < evt_nb; i++) {
+			const input_event &ev = events[i];
+			if (ev.type == EV_KEY) {
+				// Keys are independent, so no need to wait for the report.
+				if (!m_dropped && ev.code < KEY_CNT && m_key_map[ev.code] >= 0) {
+					physicalControlState[m_key_map[ev.code]] = ev.value ? FULLY_DOWN : 0;
+					status = 1;
+					changed = true;
+				}
+			} else if (ev.type == EV_SYN) {
+				if (ev.code == SYN_DROPPED) {
+					m_dropped = true;
+				} else if (ev.code == SYN_REPORT) {
+					if (m_dropped) {
+						m_dropped = false;
+						Resync();
+						status = 1;
+					} else if (changed) {
+						StampInput(EvdevEventTime(ev));
+					}
+					changed = false;
+				}
+			}
+		}
+	}
+
+	return status;
+}
+
+EvdevMouse::EvdevMouse(int fd, const wchar_t *displayName, const wchar_t *instanceID, wchar_t *productID, const evdev_caps &caps) :
+	Device(LNX_EVDEV, MOUSE, displayName, instanceID, productID), m_fd(fd), m_dx(0), m_dy(0), m_dropped(false)
+{
+	m_btn_map.assign(BTN_TASK - BTN_MOUSE + 1, -1);
+	for (int bit = BTN_MOUSE; bit <= BTN_TASK; bit++) {
+		if (testBit(bit, caps.key)) {
+			m_btn_map[bit - BTN_MOUSE] = m_btn.size();
+			m_btn.push_back(bit);
+			AddPhysicalControl(PSHBTN, bit - BTN_MOUSE, 0);
+		}
+	}
+	// CalcVirtualState expects X then Y right after the buttons, and only
+	// uses those two for mice, so wheels aren't added.
+	AddPhysicalControl(RELAXIS, 8, 0);
+	AddPhysicalControl(RELAXIS, 9, 0);
+	SetMouse();
+}
+
+EvdevMouse::~EvdevMouse() {
+	evdev_io->Close(m_fd);
+}
+
+wchar_t *EvdevMouse::GetPhysicalControlName(PhysicalControl *c) {
+	const static wchar_t *names[] = {
+		L"L Button",
+		L"R Button",
+		L"M Button",
+		L"Side Button",
+		L"Extra Button",
+		L"Forward Button",
+		L"Back Button",
+		L"Task Button",
+		L"X Axis",
+		L"Y Axis",
+	};
+	if (c->id < sizeof(names)/sizeof(names[0])) return (wchar_t*)names[c->id];
+	return Device::GetPhysicalControlName(c);
+}
+
+void EvdevMouse::Resync() {
+	ReadKeyState(m_fd, m_btn, physicalControlState);
+	m_dx = m_dy = 0;
+}
+
+int EvdevMouse::Activate(InitInfo* args) {
+	AllocState();
+
+	struct input_event events[32];
+	while (evdev_io->Read(m_fd, events, sizeof(events)) > 0);
+	m_dropped = false;
+	Resync();
+
+	active = 1;
+	return 1;
+}
+
+static LockSite motionLockSite("Device::m_mutex EvdevMouse::Update");
+
+int EvdevMouse::Update() {
+	struct input_event events[32];
+	int len;
+	bool changed = false;
+
+	while ((len = evdev_io->Read(m_fd, events, (sizeof events))) > 0) {
+		int evt_nb = len / sizeof(input_event);
+		CountInputs(evt_nb);
+		for (int i = 0; i < evt_nb; i++) {
+			const input_event &ev = events[i];
+			if (ev.type == EV_REL) {
+				if (m_dropped) continue;
+				if (ev.code == REL_X)
+					m_dx += ev.value;
+				else if (ev.code == REL_Y)
+					m_dy += ev.value;
+			} else if (ev.type == EV_KEY) {
+				if (!m_dropped && ev.code >= BTN_MOUSE && ev.code <= BTN_TASK && m_btn_map[ev.code - BTN_MOUSE] >= 0) {
+					physicalControlState[m_btn_map[ev.code - BTN_MOUSE]] = ev.value ? FULLY_DOWN : 0;
+					changed = true;
+				}
+			} else if (ev.type == EV_SYN) {
+				if (ev.code == SYN_DROPPED) {
+					m_dropped = true;
+				} else if (ev.code == SYN_REPORT) {
+					if (m_dropped) {
+						// Lost motion can't be recovered, only button state.
+						m_dropped = false;
+						Resync();
+					} else {
+						if (m_dx || m_dy) {
+							// One lock per report rather than per event.
+							ProfiledLock<std::mutex> lock(motionLockSite, m_mutex);
+							mc->mousex += m_dx;
+							mc->mousey += m_dy;
+							mc->change = 1;
+							m_dx = m_dy = 0;
+							changed = true;
+						}
+						if (changed)
+							StampInput(EvdevEventTime(ev));
+					}
+					changed = false;
+				}
+			}
+		}
+	}
+
+	// Motion smoothing has to run every frame, like the Windows mice.
+	return active;
+}
+
+static std::wstring EvdevString(int fd, unsigned long request) {
+	char buf[256] = {0};
+	if (evdev_io->Ioctl(fd, request, buf) < 0)
+		return L"";
+	std::string s(buf);
+	return std::wstring(s.begin(), s.end());
+}
+
+Device *CreateEvdevKeyboardMouse(int fd, const wchar_t *name, const evdev_caps &caps) {
+	bool wantKeyboard = config.keyboardApi == LNX_EVDEV;
+	bool wantMouse = config.mouseApi == LNX_EVDEV;
+	if (!wantKeyboard && !wantMouse)
+		return 0;
+
+	bool isKeyboard = testBit(KEY_A, caps.key) && testBit(KEY_SPACE, caps.key) && testBit(KEY_ENTER, caps.key);
+	bool isMouse = testBit(BTN_LEFT, caps.key) && testBit(REL_X, caps.rel) && testBit(REL_Y, caps.rel);
+	if (!(isKeyboard && wantKeyboard) && !(isMouse && wantMouse))
+		return 0;
+
+	// Name alone isn't unique (two of the same mouse), so add the physical
+	// path.  Product id covers the same device moving to another port.
+	struct input_id id;
+	memset(&id, 0, sizeof(id));
+	evdev_io->Ioctl(fd, EVIOCGID, &id);
+	wchar_t productID[50];
+	wsprintfW(productID, L"evdev %04X:%04X", id.vendor, id.product);
+	std::wstring instanceID = std::wstring(L"evdev ") + name + L" " + EvdevString(fd, EVIOCGPHYS(256)) + L" " + EvdevString(fd, EVIOCGUNIQ(256));
+
+	if (isKeyboard && wantKeyboard)
+		return new EvdevKeyboard(fd, name, instanceID.c_str(), productID, caps);
+	return new EvdevMouse(fd, name, instanceID.c_str(), productID, caps);
+}
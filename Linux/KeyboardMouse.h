@@ -19,6 +19,8 @@
 #include "InputManager.h"
 #include "KeyboardQueue.h"
 
+struct evdev_caps;
+
 class LinuxKeyboard : public Device {
 	public:
 		LinuxKeyboard();
@@ -26,4 +28,49 @@ class LinuxKeyboard : public Device {
 		int Update();
 };
 
+// Keyboard read straight from its /dev/input node rather than through the
+// core's PADWriteEvent queue.  Has a control for every key the device reports.
+class EvdevKeyboard : public Device {
+	int m_fd;
+	// Maps evdev key codes to physical controls, -1 when unused.
+	std::vector<int16_t> m_key_map;
+	std::vector<uint16_t> m_keys;
+	bool m_dropped;
+
+	void Resync();
+
+	public:
+		EvdevKeyboard(int fd, const wchar_t *displayName, const wchar_t *instanceID, wchar_t *productID, const evdev_caps &caps);
+		~EvdevKeyboard();
+		wchar_t *GetPhysicalControlName(PhysicalControl *c);
+		int Activate(InitInfo* args);
+		int Update();
+};
+
+// Mouse read straight from its /dev/input node.  Motion feeds the same
+// smoothing as the Windows mice.
+class EvdevMouse : public Device {
+	int m_fd;
+	std::vector<int16_t> m_btn_map;
+	std::vector<uint16_t> m_btn;
+	// Motion since the last SYN_REPORT.
+	int m_dx;
+	int m_dy;
+	bool m_dropped;
+
+	void Resync();
+
+	public:
+		EvdevMouse(int fd, const wchar_t *displayName, const wchar_t *instanceID, wchar_t *productID, const evdev_caps &caps);
+		~EvdevMouse();
+		wchar_t *GetPhysicalControlName(PhysicalControl *c);
+		int Activate(InitInfo* args);
+		int Update();
+};
+
 void EnumLnx();
+
+// Returns an EvdevKeyboard/EvdevMouse for fd if it looks like one and that API
+// is selected, otherwise 0.  Takes ownership of fd only on success.  Called
+// from enumeration threads.
+Device *CreateEvdevKeyboardMouse(int fd, const wchar_t *name, const evdev_caps &caps);
@@ -18,6 +18,7 @@
 #include "Global.h"
 // This is undoubtedly completely unnecessary.
 #include "KeyboardQueue.h"
+#include "Stats.h"
 
 #ifdef __linux__
 // Above code is for events that go from the plugin to core
@@ -27,24 +28,30 @@
 
 #define R_EVENT_QUEUE_LEN 256
 static std::mutex core_event;
+static LockSite R_queueLockSite("core_event R_QueueKeyEvent");
+static LockSite R_getQueuedLockSite("core_event R_GetQueuedKeyEvent");
 
 static u8 R_lastQueuedEvent = 0;
 static u8 R_nextQueuedEvent = 0;
 static keyEvent R_queuedEvents[R_EVENT_QUEUE_LEN];
 
 void R_QueueKeyEvent(const keyEvent &evt) {
-	std::lock_guard<std::mutex> lock(core_event);
+	ProfiledLock<std::mutex> lock(R_queueLockSite, core_event);
 
 	R_queuedEvents[R_lastQueuedEvent] = evt;
 	R_lastQueuedEvent = (R_lastQueuedEvent + 1) % R_EVENT_QUEUE_LEN;
+	CountStat(STAT_KEYS_QUEUED);
 	// In case someone has a severe Parkingson's disease
 	assert(R_nextQueuedEvent != R_lastQueuedEvent);
+	// Without asserts, the whole queue is lost.
+	if (R_nextQueuedEvent == R_lastQueuedEvent)
+		CountStat(STAT_KEYS_DROPPED, R_EVENT_QUEUE_LEN);
 }
 
 int R_GetQueuedKeyEvent(keyEvent *event) {
 	if (R_lastQueuedEvent == R_nextQueuedEvent) return 0;
 
-	std::lock_guard<std::mutex> lock(core_event);
+	ProfiledLock<std::mutex> lock(R_getQueuedLockSite, core_event);
 	*event = R_queuedEvents[R_nextQueuedEvent];
 	R_nextQueuedEvent = (R_nextQueuedEvent + 1) % R_EVENT_QUEUE_LEN;
 	return 1;
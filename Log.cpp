@@ -0,0 +1,322 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "Log.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#define LOG_RING_LEN 1024
+
+u8 logLevels[LOGCAT_COUNT];
+
+static const char *const categoryNames[LOGCAT_COUNT] = {"general", "poll", "evdev", "config"};
+static const char *const levelNames[] = {"off", "error", "info", "debug"};
+
+// Bounded multi-producer, single consumer queue.  A slot's seq is its
+// position when free to write, position + 1 once written, and position +
+// LOG_RING_LEN after it's been read.
+struct LogSlot {
+	std::atomic<u64> seq;
+	LogRecord record;
+};
+
+static struct LogRing {
+	LogSlot slots[LOG_RING_LEN];
+	std::atomic<u64> head;
+	// Only touched by the writer thread.
+	u64 tail;
+	std::atomic<u32> dropped;
+
+	LogRing() : head(0), tail(0), dropped(0) {
+		for (u64 i = 0; i < LOG_RING_LEN; i++)
+			slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+} ring;
+
+static std::mutex writerLock;
+static std::thread writer;
+static std::atomic<bool> writerQuit(false);
+// Set by the writer once it's done its last drain.
+static std::atomic<bool> writerDone(false);
+static FILE *logFile = 0;
+
+LogRecord *LogAcquire(LogCategory cat, LogLevel level, const char *fmt) {
+	u64 pos = ring.head.load(std::memory_order_relaxed);
+	while (1) {
+		LogSlot *slot = &ring.slots[pos % LOG_RING_LEN];
+		s64 diff = (s64)(slot->seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (ring.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			ring.dropped.fetch_add(1, std::memory_order_relaxed);
+			return 0;
+		}
+		else {
+			pos = ring.head.load(std::memory_order_relaxed);
+		}
+	}
+	LogRecord *record = &ring.slots[pos % LOG_RING_LEN].record;
+	record->pos = pos;
+	record->fmt = fmt;
+	record->cat = cat;
+	record->level = level;
+	record->numArgs = 0;
+	record->dataLen = 0;
+	return record;
+}
+
+void LogCommit(LogRecord *record) {
+	ring.slots[record->pos % LOG_RING_LEN].seq.store(record->pos + 1, std::memory_order_release);
+}
+
+void LogRecord::Add(const char *value) {
+	if (numArgs >= LOG_MAX_ARGS) return;
+	if (!value) value = "(null)";
+	int len = (int)strlen(value);
+	if (len > LOG_DATA_LEN - 1 - dataLen) len = LOG_DATA_LEN - 1 - dataLen;
+	if (len < 0) len = 0;
+	types[numArgs] = LOGARG_STRING;
+	args[numArgs++].u = dataLen;
+	memcpy(data + dataLen, value, len);
+	dataLen += len;
+	data[dataLen++] = 0;
+}
+
+void LogPoll(const unsigned char *in, const unsigned char *out, u32 len) {
+	if (len > LOG_DATA_LEN / 2) len = LOG_DATA_LEN / 2;
+	LogRecord *record = LogAcquire(LOGCAT_POLL, LOGLEVEL_DEBUG, 0);
+	if (!record) return;
+	memcpy(record->data, in, len);
+	memcpy(record->data + len, out, len);
+	record->dataLen = (u8)(2 * len);
+	LogCommit(record);
+}
+
+// Formats one conversion at a time, using the types recorded with the
+// arguments rather than the length modifiers in the format, so a %d given a
+// size_t still prints correctly.
+static int FormatRecord(char *out, int size, const LogRecord *r) {
+	int pos = 0;
+	int arg = 0;
+	const char *f = r->fmt;
+	while (*f && pos < size - 1) {
+		if (*f != '%') {
+			out[pos++] = *f++;
+			continue;
+		}
+		if (f[1] == '%') {
+			out[pos++] = '%';
+			f += 2;
+			continue;
+		}
+		char spec[32];
+		int specLen = 0;
+		spec[specLen++] = *f++;
+		while (*f && strchr("-+ #0123456789.", *f) && specLen < 20)
+			spec[specLen++] = *f++;
+		while (*f && strchr("hlLqjzt", *f))
+			f++;
+		char conv = *f;
+		if (!conv) break;
+		f++;
+
+		int n;
+		if (arg >= r->numArgs) {
+			n = snprintf(out + pos, size - pos, "<?>");
+		}
+		else {
+			u8 type = r->types[arg];
+			if (strchr("diuxXoc", conv)) {
+				s64 value = type == LOGARG_DOUBLE ? (s64)r->args[arg].d : r->args[arg].i;
+				if (conv == 'c') {
+					spec[specLen++] = 'c';
+					spec[specLen] = 0;
+					n = snprintf(out + pos, size - pos, spec, (int)value);
+				}
+				else {
+					spec[specLen++] = 'l';
+					spec[specLen++] = 'l';
+					spec[specLen++] = conv;
+					spec[specLen] = 0;
+					n = snprintf(out + pos, size - pos, spec, (long long)value);
+				}
+			}
+			else if (strchr("fFeEgGaA", conv)) {
+				double value = type == LOGARG_DOUBLE ? r->args[arg].d : type == LOGARG_INT ? (double)r->args[arg].i : (double)r->args[arg].u;
+				spec[specLen++] = conv;
+				spec[specLen] = 0;
+				n = snprintf(out + pos, size - pos, spec, value);
+			}
+			else if (conv == 's') {
+				spec[specLen++] = 's';
+				spec[specLen] = 0;
+				n = snprintf(out + pos, size - pos, spec, type == LOGARG_STRING ? r->data + r->args[arg].u : "<?>");
+			}
+			else {
+				n = snprintf(out + pos, size - pos, "%p", r->args[arg].p);
+			}
+			arg++;
+		}
+		if (n < 0) break;
+		pos += n;
+		if (pos > size - 1) pos = size - 1;
+	}
+	out[pos] = 0;
+	return pos;
+}
+
+static int FormatPoll(char *out, int size, const LogRecord *r) {
+	int len = r->dataLen / 2;
+	int pos = 0;
+	for (int half = 0; half < 2; half++) {
+		const unsigned char *bytes = (const unsigned char *)r->data + half * len;
+		pos += snprintf(out + pos, size - pos, "%02X (%02X)", bytes[0], bytes[1]);
+		for (int i = 2; i < len; i++)
+			pos += snprintf(out + pos, size - pos, " %02X", bytes[i]);
+		pos += snprintf(out + pos, size - pos, "\n");
+	}
+	pos += snprintf(out + pos, size - pos, "\n");
+	return pos;
+}
+
+static FILE *GetLogFile() {
+#ifdef _MSC_VER
+	if (!logFile) logFile = fopen("logs\\padLog.txt", "ab");
+	return logFile;
+#else
+	return stderr;
+#endif
+}
+
+// Returns number of records written.
+static int DrainLog() {
+	int count = 0;
+	FILE *file = GetLogFile();
+	char temp[1024];
+
+	u32 dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+	if (dropped && file) fprintf(file, "%u log records dropped\n", dropped);
+
+	while (1) {
+		LogSlot *slot = &ring.slots[ring.tail % LOG_RING_LEN];
+		if (slot->seq.load(std::memory_order_acquire) != ring.tail + 1) break;
+		const LogRecord *r = &slot->record;
+		if (file) {
+			// Poll records have no format and only ever need the file.
+			if (!r->fmt) {
+				if (r->dataLen >= 4) {
+					FormatPoll(temp, sizeof(temp), r);
+					fputs(temp, file);
+				}
+			}
+			else {
+				FormatRecord(temp, sizeof(temp), r);
+				fputs(temp, file);
+			}
+		}
+		slot->seq.store(ring.tail + LOG_RING_LEN, std::memory_order_release);
+		ring.tail++;
+		count++;
+	}
+	if (count && file) fflush(file);
+	return count;
+}
+
+static void LogWriterThread() {
+	while (!writerQuit.load(std::memory_order_relaxed)) {
+		if (!DrainLog())
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	DrainLog();
+	writerDone = true;
+}
+
+static void ParseLogOverrides(const char *s) {
+	while (*s) {
+		const char *end = strchr(s, ',');
+		if (!end) end = s + strlen(s);
+		const char *eq = (const char *)memchr(s, '=', end - s);
+		if (eq) {
+			for (int level = 0; level < (int)(sizeof(levelNames) / sizeof(levelNames[0])); level++) {
+				if ((int)strlen(levelNames[level]) != end - eq - 1 || strncmp(eq + 1, levelNames[level], end - eq - 1)) continue;
+				for (int cat = 0; cat < LOGCAT_COUNT; cat++) {
+					if ((eq - s == 3 && !strncmp(s, "all", 3)) ||
+						((int)strlen(categoryNames[cat]) == eq - s && !strncmp(s, categoryNames[cat], eq - s))) {
+						logLevels[cat] = level;
+					}
+				}
+			}
+		}
+		s = *end ? end + 1 : end;
+	}
+}
+
+void LogConfigure(int debug) {
+	for (int cat = 0; cat < LOGCAT_COUNT; cat++) {
+#ifdef _MSC_VER
+		// Never logged anything without the setting, so keep it that way.
+		logLevels[cat] = debug ? LOGLEVEL_DEBUG : LOGLEVEL_OFF;
+#else
+		logLevels[cat] = debug ? LOGLEVEL_DEBUG : LOGLEVEL_INFO;
+#endif
+	}
+	// Poll logging is about as verbose as it gets, so only on request.
+	if (!debug) logLevels[LOGCAT_POLL] = LOGLEVEL_OFF;
+
+	const char *overrides = getenv("LILYPAD_LOG");
+	if (overrides) ParseLogOverrides(overrides);
+
+	std::lock_guard<std::mutex> lock(writerLock);
+	if (!writer.joinable()) {
+		writerQuit = false;
+		writerDone = false;
+		writer = std::thread(LogWriterThread);
+	}
+}
+
+void LogStop(bool unloading) {
+	std::lock_guard<std::mutex> lock(writerLock);
+	bool drained = true;
+	if (writer.joinable()) {
+		writerQuit = true;
+		if (unloading) {
+			// The loader lock's held, and the writer can't exit without it, so
+			// joining would never return.  Wait for its last drain instead, and
+			// leave it to exit after DllMain.
+			for (int i = 0; i < 200 && !writerDone; i++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			drained = writerDone;
+			writer.detach();
+		}
+		else {
+			writer.join();
+		}
+	}
+	// Anything logged since, or everything if the writer never ran.  Not if
+	// the writer might still be draining.
+	if (drained) DrainLog();
+	if (logFile) {
+		fclose(logFile);
+		logFile = 0;
+	}
+}
@@ -0,0 +1,146 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Logging that's cheap enough to leave on.  LOG() copies the format pointer
+// and its arguments into a lock-free ring, and a background thread does the
+// actual formatting and writing.  If the ring fills up, records are dropped
+// rather than blocking, and the count is logged once there's room.
+//
+// Output goes to logs\padLog.txt on Windows, stderr on Linux.
+
+#include <type_traits>
+
+enum LogCategory {
+	LOGCAT_GENERAL,
+	// The raw bytes of every PADpoll exchange.
+	LOGCAT_POLL,
+	LOGCAT_EVDEV,
+	LOGCAT_CONFIG,
+	LOGCAT_COUNT
+};
+
+enum LogLevel {
+	LOGLEVEL_OFF,
+	LOGLEVEL_ERROR,
+	LOGLEVEL_INFO,
+	LOGLEVEL_DEBUG
+};
+
+extern u8 logLevels[LOGCAT_COUNT];
+
+static inline bool LogEnabled(LogCategory cat, LogLevel level) {
+	return logLevels[cat] >= level;
+}
+
+// Sets the levels from the "Logging" setting, then applies any overrides in
+// LILYPAD_LOG, e.g. "evdev=debug,poll=off".  Starts the writer thread if
+// it's not already running.
+void LogConfigure(int debug);
+// Writes out anything still queued and stops the writer thread.  unloading
+// is for DllMain, which can't wait for threads to exit.
+void LogStop(bool unloading = false);
+
+#define LOG_MAX_ARGS 8
+// Space for copies of string arguments, and for poll bytes.
+#define LOG_DATA_LEN 128
+
+enum LogArgType {
+	LOGARG_INT,
+	LOGARG_UINT,
+	LOGARG_DOUBLE,
+	LOGARG_STRING,
+	LOGARG_POINTER
+};
+
+struct LogRecord {
+	// Position in the ring, for LogCommit.
+	u64 pos;
+	// Must be a string literal.  null for poll records.
+	const char *fmt;
+	u8 cat;
+	u8 level;
+	u8 numArgs;
+	u8 dataLen;
+	u8 types[LOG_MAX_ARGS];
+	union {
+		s64 i;
+		u64 u;
+		double d;
+		const void *p;
+	} args[LOG_MAX_ARGS];
+	char data[LOG_DATA_LEN];
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type Add(T value) {
+		if (numArgs >= LOG_MAX_ARGS) return;
+		if (std::is_signed<T>::value) {
+			types[numArgs] = LOGARG_INT;
+			args[numArgs++].i = (s64)value;
+		}
+		else {
+			types[numArgs] = LOGARG_UINT;
+			args[numArgs++].u = (u64)value;
+		}
+	}
+	void Add(double value) {
+		if (numArgs >= LOG_MAX_ARGS) return;
+		types[numArgs] = LOGARG_DOUBLE;
+		args[numArgs++].d = value;
+	}
+	void Add(const void *value) {
+		if (numArgs >= LOG_MAX_ARGS) return;
+		types[numArgs] = LOGARG_POINTER;
+		args[numArgs++].p = value;
+	}
+	// Copied, since the string may well be on the caller's stack.
+	void Add(const char *value);
+	void Add(char *value) {
+		Add((const char *)value);
+	}
+
+	void AddAll() {
+	}
+	template <typename T, typename... Rest>
+	void AddAll(T value, Rest... rest) {
+		Add(value);
+		AddAll(rest...);
+	}
+};
+
+// Returns 0 if the ring is full.  The record must be passed to LogCommit.
+LogRecord *LogAcquire(LogCategory cat, LogLevel level, const char *fmt);
+void LogCommit(LogRecord *record);
+
+template <typename... Args>
+void LogWrite(LogCategory cat, LogLevel level, const char *fmt, Args... args) {
+	LogRecord *record = LogAcquire(cat, level, fmt);
+	if (!record) return;
+	record->AddAll(args...);
+	LogCommit(record);
+}
+
+// Logs one PADpoll exchange.  Written out as two lines of hex, as before.
+void LogPoll(const unsigned char *in, const unsigned char *out, u32 len);
+
+#define LOG(cat, level, ...)                    \
+	do {                                        \
+		if (LogEnabled(cat, level))             \
+			LogWrite(cat, level, __VA_ARGS__); \
+	} while (0)
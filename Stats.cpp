@@ -0,0 +1,392 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "InputManager.h"
+#include "Stats.h"
+#include "Log.h"
+
+#include <stdarg.h>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static LatencyHistogram stages[LATENCY_STAGES];
+
+u64 MonotonicUs() {
+#ifdef _MSC_VER
+	static LARGE_INTEGER freq = {0};
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (u64)(now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+int LatencyHistogram::BucketIndex(u64 us) {
+	if (us > 0xFFFFFFFF) us = 0xFFFFFFFF;
+	u32 v = (u32)us;
+	if (v < (1 << LATENCY_SUB_BITS)) return v;
+	int msb = 31;
+	while (!(v >> msb)) msb--;
+	int shift = msb - LATENCY_SUB_BITS;
+	return ((shift + 1) << LATENCY_SUB_BITS) + ((v >> shift) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+u64 LatencyHistogram::BucketValue(int index) {
+	if (index < (1 << LATENCY_SUB_BITS)) return index;
+	int shift = (index >> LATENCY_SUB_BITS) - 1;
+	u64 low = (u64)((1 << LATENCY_SUB_BITS) + (index & ((1 << LATENCY_SUB_BITS) - 1))) << shift;
+	return low + ((1ULL << shift) >> 1);
+}
+
+void LatencyHistogram::Record(u64 us) {
+	counts[BucketIndex(us)]++;
+	total++;
+	if (us > max) max = us;
+}
+
+u64 LatencyHistogram::Percentile(double fraction) const {
+	if (!total) return 0;
+	u64 target = (u64)(fraction * total + 0.5);
+	if (!target) target = 1;
+	u64 seen = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= target) {
+			u64 v = BucketValue(i);
+			return v < max ? v : max;
+		}
+	}
+	return max;
+}
+
+int LatencyHistogram::Format(char *out, int size) const {
+	return snprintf(out, size, "n=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu",
+		(unsigned long long)total, (unsigned long long)Percentile(0.5), (unsigned long long)Percentile(0.9),
+		(unsigned long long)Percentile(0.99), (unsigned long long)Percentile(0.999), (unsigned long long)max);
+}
+
+void RecordInputLatency(Device *dev, u64 now) {
+	if (!dev->inputReadTime) return;
+
+	stages[LATENCY_QUEUE].Record(dev->inputReadTime - dev->inputEventTime);
+	stages[LATENCY_PIPELINE].Record(now - dev->inputReadTime);
+	stages[LATENCY_TOTAL].Record(now - dev->inputEventTime);
+	if (dev->latency) dev->latency->Record(now - dev->inputEventTime);
+}
+
+// Like snprintf, but appends at pos and keeps counting past the end of the
+// buffer, so the caller gets the full length.
+static void Appendf(char *out, int size, int &pos, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(pos < size ? out + pos : 0, pos < size ? size - pos : 0, format, args);
+	va_end(args);
+	if (len > 0) pos += len;
+}
+
+int FormatLatencyStats(char *out, int size) {
+	static const char *names[LATENCY_STAGES] = {"queue", "pipeline", "total"};
+	char line[200];
+	int pos = 0;
+	for (int i = 0; i < LATENCY_STAGES; i++) {
+		stages[i].Format(line, sizeof(line));
+		Appendf(out, size, pos, "stage %s: %s\n", names[i], line);
+	}
+	for (int i = 0; dm && i < dm->numDevices; i++) {
+		Device *dev = dm->devices[i];
+		if (!dev->latency) continue;
+		dev->latency->Format(line, sizeof(line));
+		Appendf(out, size, pos, "device %ls: %s\n", dev->displayName, line);
+	}
+	return pos;
+}
+
+struct StatBlock {
+	std::atomic<u64> counts[STAT_COUNTERS];
+
+	StatBlock();
+	~StatBlock();
+};
+
+static std::mutex statLock;
+static std::vector<StatBlock*> statBlocks;
+// Counts from threads that have exited.
+static u64 statRetired[STAT_COUNTERS];
+
+StatBlock::StatBlock() {
+	for (int i = 0; i < STAT_COUNTERS; i++)
+		counts[i] = 0;
+	std::lock_guard<std::mutex> lock(statLock);
+	statBlocks.push_back(this);
+}
+
+StatBlock::~StatBlock() {
+	std::lock_guard<std::mutex> lock(statLock);
+	for (int i = 0; i < STAT_COUNTERS; i++)
+		statRetired[i] += counts[i];
+	for (size_t i = 0; i < statBlocks.size(); i++) {
+		if (statBlocks[i] == this) {
+			statBlocks.erase(statBlocks.begin() + i);
+			break;
+		}
+	}
+}
+
+void CountStat(StatCounter counter, u64 n) {
+	static thread_local StatBlock block;
+	// Only this thread writes, so no need for an atomic add.
+	block.counts[counter].store(block.counts[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static LockSite *lockSites = 0;
+
+LockSite::LockSite(const char *name) : name(name), acquisitions(0), contended(0) {
+	busy.clear();
+	memset(&wait, 0, sizeof(wait));
+	memset(&hold, 0, sizeof(hold));
+	next = lockSites;
+	lockSites = this;
+}
+
+void LockSite::Acquired(bool wasContended, u64 waitUs) {
+	acquisitions.fetch_add(1, std::memory_order_relaxed);
+	if (wasContended) contended.fetch_add(1, std::memory_order_relaxed);
+	if (busy.test_and_set(std::memory_order_acquire)) return;
+	wait.Record(waitUs);
+	busy.clear(std::memory_order_release);
+}
+
+void LockSite::Released(u64 holdUs) {
+	if (busy.test_and_set(std::memory_order_acquire)) return;
+	hold.Record(holdUs);
+	busy.clear(std::memory_order_release);
+}
+
+#ifdef LILYPAD_ALLOC_STATS
+static thread_local u64 threadAllocations = 0;
+
+// The parentheses keep the macros in Global.h from applying.
+void * CountedMalloc(size_t size) {
+	threadAllocations++;
+	return (malloc)(size);
+}
+
+void * CountedCalloc(size_t num, size_t size) {
+	threadAllocations++;
+	return (calloc)(num, size);
+}
+
+void * CountedRealloc(void *mem, size_t size) {
+	// Freeing isn't a problem.
+	if (size) threadAllocations++;
+	return (realloc)(mem, size);
+}
+
+// Same for new and delete.  Hidden, so they only replace them within the
+// plugin, not in the emulator that loads it.
+#ifdef __GNUC__
+#define ALLOC_HOOK __attribute__((visibility("hidden")))
+#else
+#define ALLOC_HOOK
+#endif
+
+ALLOC_HOOK void * operator new(size_t size) {
+	void *mem = CountedMalloc(size ? size : 1);
+	if (!mem) throw std::bad_alloc();
+	return mem;
+}
+
+ALLOC_HOOK void * operator new[](size_t size) {
+	return operator new(size);
+}
+
+ALLOC_HOOK void * operator new(size_t size, const std::nothrow_t &) noexcept {
+	return CountedMalloc(size ? size : 1);
+}
+
+ALLOC_HOOK void * operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return CountedMalloc(size ? size : 1);
+}
+
+ALLOC_HOOK void operator delete(void *mem) noexcept {
+	free(mem);
+}
+
+ALLOC_HOOK void operator delete[](void *mem) noexcept {
+	free(mem);
+}
+
+ALLOC_HOOK void operator delete(void *mem, size_t) noexcept {
+	free(mem);
+}
+
+ALLOC_HOOK void operator delete[](void *mem, size_t) noexcept {
+	free(mem);
+}
+
+ALLOC_HOOK void operator delete(void *mem, const std::nothrow_t &) noexcept {
+	free(mem);
+}
+
+ALLOC_HOOK void operator delete[](void *mem, const std::nothrow_t &) noexcept {
+	free(mem);
+}
+
+u64 ThreadAllocations() {
+	return threadAllocations;
+}
+
+// About 5 seconds of frames.
+#define ALLOC_WARMUP_FRAMES 500
+
+void CheckFrameAllocations() {
+	static InputDeviceManager *lastDm = 0;
+	static int lastDevices = 0;
+	static int lastActive = 0;
+	static int settledFrames = 0;
+	static u64 last = 0;
+
+	int active = 0;
+	for (int i = 0; dm && i < dm->numDevices; i++)
+		active += dm->devices[i]->active;
+	u64 now = threadAllocations;
+	u64 allocated = now - last;
+	last = now;
+
+	// Device setup and activation are allowed to allocate.
+	if (dm != lastDm || !dm || dm->numDevices != lastDevices || active != lastActive) {
+		lastDm = dm;
+		lastDevices = dm ? dm->numDevices : 0;
+		lastActive = active;
+		settledFrames = 0;
+		return;
+	}
+	if (settledFrames < ALLOC_WARMUP_FRAMES) {
+		settledFrames++;
+		return;
+	}
+	if (allocated) {
+		CountStat(STAT_STEADY_ALLOCATIONS, allocated);
+		LOG(LOGCAT_GENERAL, LOGLEVEL_ERROR, "%llu allocations in a steady state frame\n", allocated);
+	}
+}
+#endif
+
+int FormatStats(char *out, int size) {
+	static const char *names[STAT_COUNTERS] = {
+		"frames", "frames_gated", "keys_queued", "keys_dropped",
+		"ff_writes", "activate_failures", "enumerations", "steady_allocations",
+		"poll_quarantines",
+	};
+	u64 totals[STAT_COUNTERS];
+	{
+		std::lock_guard<std::mutex> lock(statLock);
+		for (int i = 0; i < STAT_COUNTERS; i++) {
+			totals[i] = statRetired[i];
+			for (size_t j = 0; j < statBlocks.size(); j++)
+				totals[i] += statBlocks[j]->counts[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	int pos = 0;
+	for (int i = 0; i < STAT_COUNTERS; i++)
+		Appendf(out, size, pos, "%s %llu\n", names[i], (unsigned long long)totals[i]);
+	for (int i = 0; dm && i < dm->numDevices; i++) {
+		Device *dev = dm->devices[i];
+		u64 updates = dev->statUpdates.load(std::memory_order_relaxed);
+		if (!updates) continue;
+		Appendf(out, size, pos, "device %ls: inputs=%llu updates=%llu update_avg_us=%llu update_max_us=%llu\n",
+			dev->displayName, (unsigned long long)dev->statInputs.load(std::memory_order_relaxed), (unsigned long long)updates,
+			(unsigned long long)(dev->statUpdateUs.load(std::memory_order_relaxed) / updates),
+			(unsigned long long)dev->statUpdateMaxUs.load(std::memory_order_relaxed));
+	}
+	// Other sites' locks aren't held, so their histograms may be mid-update.
+	// Close enough for a report.
+	for (LockSite *site = lockSites; site; site = site->next) {
+		u64 acquisitions = site->acquisitions.load(std::memory_order_relaxed);
+		if (!acquisitions) continue;
+		char wait[200], hold[200];
+		site->wait.Format(wait, sizeof(wait));
+		site->hold.Format(hold, sizeof(hold));
+		Appendf(out, size, pos, "lock %s: acquisitions=%llu contended=%llu\n  wait_us %s\n  hold_us %s\n", site->name,
+			(unsigned long long)acquisitions, (unsigned long long)site->contended.load(std::memory_order_relaxed), wait, hold);
+	}
+	return pos;
+}
+
+#ifdef __linux__
+// Readers retry while seq is odd or changes under them.
+struct StatsMirror {
+	std::atomic<u32> seq;
+	u32 length;
+	char text[1];
+};
+
+#define STATS_MIRROR_SIZE (64 * 1024)
+
+void MirrorStats() {
+	static int enabled = -1;
+	static StatsMirror *mirror = 0;
+	static u64 last = 0;
+
+	if (enabled < 0) {
+		enabled = getenv("LILYPAD_STATS_SHM") != 0;
+		if (enabled) {
+			char path[64];
+			snprintf(path, sizeof(path), "/dev/shm/lilypad-stats-%d", (int)getpid());
+			int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd >= 0 && ftruncate(fd, STATS_MIRROR_SIZE) == 0) {
+				void *p = mmap(0, STATS_MIRROR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (p != MAP_FAILED) mirror = (StatsMirror*)p;
+			}
+			if (fd >= 0) close(fd);
+			if (!mirror) {
+				LOG(LOGCAT_GENERAL, LOGLEVEL_ERROR, "Couldn't create %s\n", path);
+				enabled = 0;
+			}
+		}
+	}
+	if (!mirror) return;
+
+	u64 now = MonotonicUs();
+	if (now - last < 1000000) return;
+	last = now;
+
+	int max = STATS_MIRROR_SIZE - (int)offsetof(StatsMirror, text);
+	mirror->seq.fetch_add(1, std::memory_order_acq_rel);
+	int len = FormatStats(mirror->text, max);
+	mirror->length = len < max ? len : max - 1;
+	mirror->seq.fetch_add(1, std::memory_order_release);
+}
+#else
+void MirrorStats() {
+}
+#endif
@@ -0,0 +1,172 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+// Monotonic clock in microseconds.  All latency measurements use this, and
+// evdev devices are set to report event times on the same clock.
+u64 MonotonicUs();
+
+// Log-linear histogram, HDR style.  Values under 16 get their own bucket,
+// above that each power of two is split into 16, so any value is recorded to
+// within about 6%.  Covers 1 us up to about 70 minutes in 2 KB.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS ((32 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+struct LatencyHistogram {
+	u32 counts[LATENCY_BUCKETS];
+	u64 total;
+	u64 max;
+
+	void Record(u64 us);
+	// Approximate value at or under which fraction of the samples fall.
+	u64 Percentile(double fraction) const;
+	// Writes "n=... p50=... p90=... p99=... p99.9=... max=..." to out.
+	int Format(char *out, int size) const;
+
+	// Bucket a value's counted in, and the middle of a bucket.
+	static int BucketIndex(u64 us);
+	static u64 BucketValue(int index);
+};
+
+enum LatencyStage {
+	// Event time to when the plugin read it.  Only meaningful for devices
+	// that report their own event times, same as total for the rest.
+	LATENCY_QUEUE,
+	// Read to first appearance in the data handed to the host.
+	LATENCY_PIPELINE,
+	// Event time to first appearance.
+	LATENCY_TOTAL,
+	LATENCY_STAGES
+};
+
+class Device;
+
+// Records dev's pending input, if any, as having just reached the host.
+void RecordInputLatency(Device *dev, u64 now);
+
+// Formats all stages and per-device totals, in the same way as snprintf.
+int FormatLatencyStats(char *out, int size);
+
+enum StatCounter {
+	// UpdateRP calls that evaluated bindings, and ones turned away by the
+	// 10 ms gate.
+	STAT_FRAMES,
+	STAT_FRAMES_GATED,
+	// Both directions of the keyboard queues.  Dropped means overwritten or
+	// refused because the queue was full or blocked.
+	STAT_KEYS_QUEUED,
+	STAT_KEYS_DROPPED,
+	// Writes to force feedback hardware, after any filtering of repeats.
+	STAT_FF_WRITES,
+	STAT_ACTIVATE_FAILURES,
+	STAT_ENUMERATIONS,
+	// Heap allocations on the update thread once the device list has
+	// settled.  Only counted when built with LILYPAD_ALLOC_STATS.
+	STAT_STEADY_ALLOCATIONS,
+	// Polled devices put on a slower poll rate for taking too long to update.
+	STAT_POLL_QUARANTINES,
+	STAT_COUNTERS
+};
+
+// Each thread counts into its own block, so this is just a relaxed add with
+// no lock or shared cache line.  Blocks are summed when stats are read.
+void CountStat(StatCounter counter, u64 n = 1);
+
+// Acquisition counts and wait and hold times for one place a lock is taken.
+// Sites must be file scope statics, so they're all registered before any
+// threads start.  Samples are recorded with the lock held, so the histograms
+// need no lock of their own.  The one exception is a lock that's per object,
+// like Device::m_mutex, where two objects' locks could be held at once.  The
+// busy flag skips a sample rather than let them collide.
+struct LockSite {
+	const char *name;
+	LockSite *next;
+	std::atomic<u64> acquisitions;
+	std::atomic<u64> contended;
+	std::atomic_flag busy;
+	LatencyHistogram wait;
+	LatencyHistogram hold;
+
+	LockSite(const char *name);
+	void Acquired(bool wasContended, u64 waitUs);
+	void Released(u64 holdUs);
+};
+
+static inline bool TryLock(std::mutex &m) {
+	return m.try_lock();
+}
+static inline void Lock(std::mutex &m) {
+	m.lock();
+}
+static inline void Unlock(std::mutex &m) {
+	m.unlock();
+}
+#ifdef _MSC_VER
+static inline bool TryLock(CRITICAL_SECTION &cs) {
+	return TryEnterCriticalSection(&cs) != 0;
+}
+static inline void Lock(CRITICAL_SECTION &cs) {
+	EnterCriticalSection(&cs);
+}
+static inline void Unlock(CRITICAL_SECTION &cs) {
+	LeaveCriticalSection(&cs);
+}
+#endif
+
+// Scoped lock that records into a LockSite.  Works with std::mutex, and with
+// CRITICAL_SECTION on Windows.
+template <typename L>
+class ProfiledLock {
+	LockSite &site;
+	L &lock;
+	u64 acquired;
+
+	public:
+		ProfiledLock(LockSite &site, L &lock) : site(site), lock(lock) {
+			u64 start = MonotonicUs();
+			bool wasContended = !TryLock(lock);
+			if (wasContended) Lock(lock);
+			acquired = MonotonicUs();
+			site.Acquired(wasContended, acquired - start);
+		}
+		~ProfiledLock() {
+			site.Released(MonotonicUs() - acquired);
+			Unlock(lock);
+		}
+};
+
+// Formats global counters, per-device update stats and lock sites, in the
+// same way as snprintf.  Called with updateLock held.
+int FormatStats(char *out, int size);
+
+#ifdef LILYPAD_ALLOC_STATS
+// Allocations made by the calling thread.
+u64 ThreadAllocations();
+// Called by UpdateRP once per frame, with updateLock held.  Once the devices
+// have been unchanged for a few seconds, anything the thread allocated since
+// the last frame is counted, and logged.
+void CheckFrameAllocations();
+#endif
+
+// Mirrors FormatStats() to /dev/shm/lilypad-stats-<pid> about once a second,
+// if LILYPAD_STATS_SHM is set.  Called from the update thread.
+void MirrorStats();
@@ -0,0 +1,100 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Global.h"
+#include "Trace.h"
+
+#ifdef LILYPAD_TRACE
+
+#include "Stats.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct TraceEvent {
+	const char *name;
+	u64 start;
+	u64 duration;
+};
+
+struct TraceRing {
+	TraceEvent events[TRACE_RING_LEN];
+	// Total ever written.  Only the owning thread writes.
+	std::atomic<u64> count;
+	u32 tid;
+
+	TraceRing();
+};
+
+static std::mutex traceLock;
+// Never freed, so a dump still has zones from threads that have exited.
+static std::vector<TraceRing*> traceRings;
+
+TraceRing::TraceRing() : count(0) {
+	std::lock_guard<std::mutex> lock(traceLock);
+	tid = (u32)traceRings.size() + 1;
+	traceRings.push_back(this);
+}
+
+static TraceRing *GetRing() {
+	static thread_local TraceRing *ring = 0;
+	if (!ring) ring = new TraceRing();
+	return ring;
+}
+
+TraceScope::TraceScope(const char *name) : name(name), start(MonotonicUs()) {
+}
+
+TraceScope::~TraceScope() {
+	TraceRing *ring = GetRing();
+	u64 n = ring->count.load(std::memory_order_relaxed);
+	TraceEvent &e = ring->events[n % TRACE_RING_LEN];
+	e.name = name;
+	e.start = start;
+	e.duration = MonotonicUs() - start;
+	ring->count.store(n + 1, std::memory_order_release);
+}
+
+void TraceDump() {
+	const char *path = getenv("LILYPAD_TRACE_FILE");
+	if (!path) path = "lilypad-trace.json";
+	FILE *f = fopen(path, "w");
+	if (!f) return;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool first = true;
+	std::lock_guard<std::mutex> lock(traceLock);
+	for (size_t r = 0; r < traceRings.size(); r++) {
+		TraceRing *ring = traceRings[r];
+		// The owner may still be writing.  Skip the oldest few, which are the
+		// ones it could be overwriting.
+		u64 end = ring->count.load(std::memory_order_acquire);
+		u64 begin = end > TRACE_RING_LEN - 16 ? end - (TRACE_RING_LEN - 16) : 0;
+		for (u64 i = begin; i < end; i++) {
+			const TraceEvent &e = ring->events[i % TRACE_RING_LEN];
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u}",
+				first ? "" : ",\n", e.name, (unsigned long long)e.start, (unsigned long long)e.duration, ring->tid);
+			first = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Scoped trace zones, for seeing how a frame is put together.  Compiled out
+// unless LILYPAD_TRACE is defined.  When it is, each thread records into its
+// own ring of the last TRACE_RING_LEN zones, and everything is written out as
+// Chrome trace-event JSON (chrome://tracing, Perfetto) on PADclose.
+//
+// name must be a string literal, or otherwise outlive the plugin.
+
+#ifdef LILYPAD_TRACE
+
+#define TRACE_RING_LEN 8192
+
+class TraceScope {
+	const char *name;
+	u64 start;
+
+	public:
+		TraceScope(const char *name);
+		~TraceScope();
+};
+
+// Writes all threads' zones to LILYPAD_TRACE_FILE, or lilypad-trace.json.
+void TraceDump();
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_DUMP() TraceDump()
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_DUMP()
+
+#endif
@@ -21,11 +21,17 @@
 #include "WindowsKeyboard.h"
 #include "KeyboardQueue.h"
 
+static DeviceLayout keyboardLayout;
+
 WindowsKeyboard::WindowsKeyboard(DeviceAPI api, wchar_t *displayName, wchar_t *instanceID, wchar_t *deviceID) :
 Device(api, KEYBOARD, displayName, instanceID, deviceID) {
-	for (int i=0; i<256; i++) {
-		AddPhysicalControl(PSHBTN, i, i);
+	if (!UseLayout(&keyboardLayout)) {
+		for (int i=0; i<256; i++) {
+			AddPhysicalControl(PSHBTN, i, i);
+		}
+		SaveLayout(&keyboardLayout);
 	}
+	EnableSparseState();
 }
 
 wchar_t *WindowsKeyboard::GetPhysicalControlName(PhysicalControl *control) {
@@ -48,7 +54,7 @@ void WindowsKeyboard::UpdateKey(int vkey, int state) {
 				QueueKeyEvent(vkey, event);
 			}
 		}
-		physicalControlState[vkey] = newState;
+		SetButtonState(vkey, newState);
 	}
 }
 
@@ -19,12 +19,18 @@
 #include "InputManager.h"
 #include "VKey.h"
 #include "WindowsMouse.h"
+#include "Stats.h"
 
 POINT WindowsMouse::origCursorPos;
 POINT WindowsMouse::center;
 
+// With and without a horizontal wheel.
+static DeviceLayout mouseLayouts[2];
+
 WindowsMouse::WindowsMouse(DeviceAPI api, int hWheel, wchar_t *displayName, wchar_t *instanceID, wchar_t *deviceID) :
 Device(api, MOUSE, displayName, instanceID, deviceID) {
+	SetMouse();
+	if (UseLayout(&mouseLayouts[hWheel])) return;
 	int i;
 	for (i=0; i<5; i++) {
 		AddPhysicalControl(PSHBTN, i, i);
@@ -33,7 +39,7 @@ Device(api, MOUSE, displayName, instanceID, deviceID) {
 	for (i=0; i<3+hWheel; i++) {
 		AddPhysicalControl(RELAXIS, i+5, i+5);
 	}
-	isMouse = true;
+	SaveLayout(&mouseLayouts[hWheel]);
 }
 
 wchar_t *WindowsMouse::GetPhysicalControlName(PhysicalControl *control) {
@@ -55,17 +61,23 @@ wchar_t *WindowsMouse::GetPhysicalControlName(PhysicalControl *control) {
 void WindowsMouse::UpdateButton(unsigned int button, int state) {
 	if (button > 4) return;
 	physicalControlState[button] = (state << 16);
+	// Mice don't get stamped by the device manager.  Messages arrive on the
+	// same thread as updates, so this is safe.
+	StampInput(0);
 }
 
+static LockSite axisLockSite("Device::m_mutex WindowsMouse::UpdateAxis");
+
 void WindowsMouse::UpdateAxis(unsigned int axis, int delta) {
 	if (axis > 3) return;
 	// 1 mouse pixel = 1/8th way down.
-	std::lock_guard<std::mutex> lock(m_mutex);
+	ProfiledLock<std::mutex> lock(axisLockSite, m_mutex);
 	if (axis == 0)
-		mc.mousex += delta;
+		mc->mousex += delta;
 	else if (axis == 1)
-		mc.mousey += delta;
-	mc.change = 1;
+		mc->mousey += delta;
+	mc->change = 1;
+	StampInput(0);
 	//physicalControlState[5 + axis] += delta;
 	//physicalControlState[5+axis] += (delta<<(16 - 3*(axis < 2))); //Not sure what this value is but we just need pixels
 }
@@ -20,6 +20,7 @@
 #include "VKey.h"
 #include "InputManager.h"
 #include "XInputEnum.h"
+#include "Stats.h"
 
 /* the secret function outputs a different struct than the official GetState. */
 typedef struct
@@ -46,6 +47,8 @@ _XInputSetState pXInputSetState = 0;
 _XInputSecretGetState pXInputSecretGetState = 0;
 
 static int xInputActiveCount = 0;
+// Devices deactivate themselves on their poller threads.
+static std::mutex xInputActiveLock;
 
 // Completely unncessary, really.
 __forceinline int ShortToAxis(int v) {
@@ -57,6 +60,8 @@ __forceinline int ShortToAxis(int v) {
 
 static const int guide_button_value = 0x0400;
 
+static DeviceLayout xInputLayout;
+
 class XInputDevice : public Device {
 	// Cached last vibration values by pad and motor.
 	// Need this, as only one value is changed at a time.
@@ -71,6 +76,9 @@ public:
 		memset(ps2Vibration, 0, sizeof(ps2Vibration));
 		memset(&xInputVibration, 0, sizeof(xInputVibration));
 		this->index = index;
+		// Wired 360 pads report at 125 Hz.
+		pollHz = 125;
+		if (UseLayout(&xInputLayout)) return;
 		int i;
 		for (i=0; i<15; i++) {
 			// The i > 9 accounts for the 2 bit skip in button flags.
@@ -86,6 +94,7 @@ public:
 		AddFFAxis(L"Slow Motor", 0);
 		AddFFAxis(L"Fast Motor", 1);
 		AddFFEffectType(L"Constant Effect", L"Constant", EFFECT_CONSTANT);
+		SaveLayout(&xInputLayout);
 	}
 
 	wchar_t *GetPhysicalControlName(PhysicalControl *c) {
@@ -121,10 +130,13 @@ public:
 
 	int Activate(InitInfo *initInfo) {
 		if (active) Deactivate();
-		if (!xInputActiveCount) {
-			pXInputEnable(1);
+		{
+			std::lock_guard<std::mutex> lock(xInputActiveLock);
+			if (!xInputActiveCount) {
+				pXInputEnable(1);
+			}
+			xInputActiveCount++;
 		}
-		xInputActiveCount++;
 		active = 1;
 		AllocState();
 		return 1;
@@ -180,6 +192,7 @@ public:
 		}
 		if (newVibration[0] || newVibration[1] || newVibration[0] != xInputVibration.wLeftMotorSpeed || newVibration[1] != xInputVibration.wRightMotorSpeed) {
 			XINPUT_VIBRATION newv = {newVibration[0], newVibration[1]};
+			CountStat(STAT_FF_WRITES);
 			if (ERROR_SUCCESS == pXInputSetState(index, &newv)) {
 				xInputVibration = newv;
 			}
@@ -201,6 +214,7 @@ public:
 
 		FreeState();
 		if (active) {
+			std::lock_guard<std::mutex> lock(xInputActiveLock);
 			if (!--xInputActiveCount) {
 				pXInputEnable(0);
 			}
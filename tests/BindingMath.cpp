@@ -0,0 +1,187 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// BindingMath.h: sticks written by more than one binding, button hysteresis,
+// buttons held by more than one source, and stick curves.
+
+#include "TestUtils.h"
+#include "BindingMath.h"
+
+// Two bindings driving one axis, in either order, over several frames.  The
+// host clears updated once it's seen it.
+static void TestStickSources() {
+	for (int order = 0; order < 2; order++) {
+		static const int frames[][2] = {
+			{0, 0}, {0, 100}, {0, 100}, {-50, 0}, {0, 0}, {30, 0}, {0, 0},
+		};
+		static const int expected[] = {0, 100, 100, -50, 0, 30, 0};
+		static const bool changed[] = {false, true, false, true, true, true, true};
+		int axis = 0;
+		for (int f = 0; f < (int)(sizeof(expected) / sizeof(expected[0])); f++) {
+			bool updated = false;
+			StickAxisFrame frame = {false, false, 0};
+			SetStickAxis(axis, updated, frame, frames[f][order]);
+			SetStickAxis(axis, updated, frame, frames[f][!order]);
+			CHECK_EQ(axis, expected[f]);
+			CHECK_EQ(updated, changed[f]);
+		}
+	}
+
+	// Both non-zero: the last one set wins.
+	int axis = 0;
+	bool updated = false;
+	StickAxisFrame frame = {false, false, 0};
+	SetStickAxis(axis, updated, frame, 40);
+	SetStickAxis(axis, updated, frame, -60);
+	CHECK_EQ(axis, -60);
+	CHECK(updated);
+
+	// Set back to where it started: no update.
+	frame.written = false;
+	updated = false;
+	SetStickAxis(axis, updated, frame, 20);
+	CHECK(updated);
+	SetStickAxis(axis, updated, frame, -60);
+	CHECK_EQ(axis, -60);
+	CHECK(!updated);
+
+	// An update the host hasn't seen yet is left alone.
+	frame.written = false;
+	updated = true;
+	SetStickAxis(axis, updated, frame, -60);
+	CHECK(updated);
+}
+
+static void TestButtons() {
+	CHECK_EQ(ScaleButtonState(BASE_SENSITIVITY, 0), 0);
+	CHECK_EQ(ScaleButtonState(BASE_SENSITIVITY, FULLY_DOWN), 127);
+	CHECK_EQ(ScaleButtonState(2 * BASE_SENSITIVITY, FULLY_DOWN / 2), 127);
+	CHECK_EQ(ButtonDeadZone(0), 0);
+	CHECK_EQ(ButtonDeadZone(BASE_SENSITIVITY), 127);
+
+	int dz = ButtonDeadZone(DEFAULT_DEADZONE);
+	CHECK(dz > 0 && dz + BUTTON_HYSTERESIS < 127);
+
+	// Digital controls press as soon as they're past the dead zone.
+	CHECK(!ButtonDown(false, dz, DEFAULT_DEADZONE, false));
+	CHECK(ButtonDown(false, dz + 1, DEFAULT_DEADZONE, false));
+	CHECK(!ButtonDown(true, dz, DEFAULT_DEADZONE, false));
+
+	// Analog ones have to get further to press, and release at the dead zone.
+	CHECK(!ButtonDown(false, dz + BUTTON_HYSTERESIS, DEFAULT_DEADZONE, true));
+	CHECK(ButtonDown(false, dz + BUTTON_HYSTERESIS + 1, DEFAULT_DEADZONE, true));
+	CHECK(ButtonDown(true, dz + 1, DEFAULT_DEADZONE, true));
+	CHECK(!ButtonDown(true, dz, DEFAULT_DEADZONE, true));
+
+	// An analog control wobbling around just past the dead zone doesn't
+	// toggle the button once it's settled.
+	for (int start = 0; start < 2; start++) {
+		bool down = start != 0;
+		for (int i = 0; i < 100; i++) {
+			int state = dz + 1 + (i * 7) % BUTTON_HYSTERESIS;
+			CHECK_EQ(ButtonDown(down, state, DEFAULT_DEADZONE, true), down);
+		}
+	}
+}
+
+// A regular binding and turbo on the same button.  Turbo's releases don't
+// let go of it while the regular binding holds it.
+static void TestButtonSources() {
+	ButtonSources s;
+	memset(&s, 0, sizeof(s));
+	const u32 x = 1 << 14;
+	const u32 other = 1 << 3;
+
+	// Turbo alone alternates.
+	for (int frame = 0; frame < 4 * TURBO_FRAMES; frame++) {
+		StepTurbo(&s, x);
+		bool down = !((frame / TURBO_FRAMES) & 1);
+		CHECK_EQ((SourceButtons(&s) & x) != 0, down);
+	}
+
+	// Held by a binding, whichever kind, it stays down throughout.
+	for (int source = 0; source < 2; source++) {
+		u32 &held = source ? s.matrix : s.bindings;
+		held = x | other;
+		for (int frame = 0; frame < 4 * TURBO_FRAMES; frame++) {
+			StepTurbo(&s, x);
+			CHECK_EQ(SourceButtons(&s), x | other);
+		}
+		held = 0;
+	}
+
+	// Let go of turbo, and the binding's release goes through.
+	StepTurbo(&s, 0);
+	CHECK_EQ(SourceButtons(&s), 0);
+
+	// Same for combos: a finished tap doesn't release a held button.
+	s.bindings = x;
+	s.combos = x;
+	CHECK_EQ(SourceButtons(&s), x);
+	s.combos = 0;
+	CHECK_EQ(SourceButtons(&s), x);
+	s.bindings = 0;
+	CHECK_EQ(SourceButtons(&s), 0);
+}
+
+static void TestStickCurve() {
+	u16 curve[STICK_CURVE_LEN + 1];
+	int x, y;
+
+	BuildStickCurve(curve, 0, 0);
+	for (int i = 1; i <= STICK_CURVE_LEN; i++)
+		CHECK(curve[i] >= curve[i - 1]);
+	ApplyStickCurve(curve, 0, 0, x, y);
+	CHECK(x == 0 && y == 0);
+	ApplyStickCurve(curve, FULLY_DOWN, 0, x, y);
+	CHECK(x >= 126 && x <= 127 && y == 0);
+	ApplyStickCurve(curve, 0, -FULLY_DOWN, x, y);
+	CHECK(x == 0 && y <= -126 && y >= -127);
+	ApplyStickCurve(curve, FULLY_DOWN / 2, 0, x, y);
+	CHECK(x >= 62 && x <= 64);
+	// Direction is kept.
+	ApplyStickCurve(curve, -FULLY_DOWN / 2, FULLY_DOWN / 2, x, y);
+	CHECK(x == -y && y > 0);
+	// Past full is clamped to full.
+	ApplyStickCurve(curve, 2 * FULLY_DOWN, 0, x, y);
+	CHECK(x >= 126 && x <= 127);
+
+	// Radial dead zone of a quarter, then linear out to full.
+	BuildStickCurve(curve, BASE_SENSITIVITY / 4, 0);
+	ApplyStickCurve(curve, FULLY_DOWN / 5, 0, x, y);
+	CHECK(x == 0 && y == 0);
+	ApplyStickCurve(curve, FULLY_DOWN / 5, FULLY_DOWN / 5, x, y);
+	CHECK(x > 0 && x == y);
+	ApplyStickCurve(curve, FULLY_DOWN * 5 / 8, 0, x, y);
+	CHECK(x >= 61 && x <= 65);
+	ApplyStickCurve(curve, FULLY_DOWN, 0, x, y);
+	CHECK(x >= 126 && x <= 127);
+
+	// Squared.  Halfway comes out at a quarter.
+	BuildStickCurve(curve, 0, 2 * BASE_SENSITIVITY);
+	ApplyStickCurve(curve, FULLY_DOWN / 2, 0, x, y);
+	CHECK(x >= 30 && x <= 33);
+}
+
+int main() {
+	TestStickSources();
+	TestButtons();
+	TestButtonSources();
+	TestStickCurve();
+	return TestResult();
+}
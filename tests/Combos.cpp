@@ -0,0 +1,147 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Combos on a device whose buttons are set directly: sequences that
+// overlap or share a prefix all fire from one set of presses, sequences
+// time out, and chords and layers hold their buttons while held.
+
+#include "TestUtils.h"
+
+#define COMBO_DEVICE L"Combo Test Device"
+#define COMBO_BUTTONS 6
+#define COMBO_TIMEOUT 50
+
+enum {
+	CTL_A, CTL_B, CTL_C, CTL_D, CTL_E, CTL_F
+};
+
+static Device *dev;
+
+static void AddTestCombo(ComboType type, int layer, int command, int numInputs, const int *inputs) {
+	Combo combo;
+	memset(&combo, 0, sizeof(combo));
+	combo.type = type;
+	combo.layer = layer;
+	combo.command = command;
+	combo.timeout = COMBO_TIMEOUT;
+	combo.numInputs = numInputs;
+	for (int i = 0; i < numInputs; i++) {
+		combo.inputs[i].instanceID = wcsdup(COMBO_DEVICE);
+		combo.inputs[i].uid = inputs[i] | (PSHBTN << 16);
+	}
+	AddCombo(&combo);
+}
+
+static void Set(int button, bool down, u32 now) {
+	dev->virtualControlState[button] = down ? FULLY_DOWN : 0;
+	UpdateCombos(now);
+}
+
+static void Tap(int button, u32 now) {
+	Set(button, true, now);
+	Set(button, false, now);
+}
+
+// Pad buttons combos are pressing, as command - 0x10 bits.
+static u32 Buttons(u32 now) {
+	return ComboButtons(0, 0, now);
+}
+
+int main() {
+	dm = new InputDeviceManager();
+	dev = new Device(LNX_KEYBOARD, KEYBOARD, COMBO_DEVICE, COMBO_DEVICE);
+	for (int i = 0; i < COMBO_BUTTONS; i++)
+		dev->AddPhysicalControl(PSHBTN, i, 0);
+	dm->AddDevice(dev);
+	dev->AllocState();
+	dev->active = 1;
+
+	static const int abc[] = {CTL_A, CTL_B, CTL_C};
+	static const int de[] = {CTL_D, CTL_E};
+	static const int f[] = {CTL_F};
+	AddTestCombo(COMBO_SEQUENCE, 0, 0x10 + 1, 3, abc);
+	AddTestCombo(COMBO_SEQUENCE, 0, 0x10 + 2, 2, abc + 1);
+	AddTestCombo(COMBO_SEQUENCE, 0, 0x10 + 3, 2, abc);
+	AddTestCombo(COMBO_CHORD, 0, 0x10 + 4, 2, de);
+	AddTestCombo(COMBO_LAYER, 0, 1, 1, f);
+	// Only on layer 1.
+	AddTestCombo(COMBO_CHORD, 1, 0x10 + 5, 1, abc);
+
+	// A B C: AB on B, then ABC and its suffix BC together on C.
+	u32 t = 1000;
+	Tap(CTL_A, t);
+	CHECK_EQ(Buttons(t), 0);
+	Tap(CTL_B, t + 10);
+	CHECK_EQ(Buttons(t + 10), 1 << 3);
+	Tap(CTL_C, t + 20);
+	CHECK_EQ(Buttons(t + 20), (1 << 1) | (1 << 2) | (1 << 3));
+	// Taps are let go after a while.
+	CHECK_EQ(Buttons(t + 500), 0);
+
+	// A A B: the second A restarts AB rather than breaking it.
+	t = 2000;
+	Tap(CTL_A, t);
+	Tap(CTL_A, t + 10);
+	Tap(CTL_B, t + 20);
+	CHECK_EQ(Buttons(t + 20), 1 << 3);
+	CHECK_EQ(Buttons(t + 500), 0);
+
+	// A, too long a wait, then B C: only BC, started fresh from B.
+	t = 3000;
+	Tap(CTL_A, t);
+	Tap(CTL_B, t + COMBO_TIMEOUT + 10);
+	CHECK_EQ(Buttons(t + COMBO_TIMEOUT + 10), 0);
+	Tap(CTL_C, t + COMBO_TIMEOUT + 20);
+	CHECK_EQ(Buttons(t + COMBO_TIMEOUT + 20), 1 << 2);
+	CHECK_EQ(Buttons(t + 500), 0);
+
+	// Chords hold while every input is.
+	t = 4000;
+	Set(CTL_D, true, t);
+	CHECK_EQ(Buttons(t), 0);
+	Set(CTL_E, true, t);
+	CHECK_EQ(Buttons(t), 1 << 4);
+	CHECK_EQ(Buttons(t + 500), 1 << 4);
+	Set(CTL_D, false, t + 500);
+	CHECK_EQ(Buttons(t + 500), 0);
+	Set(CTL_E, false, t + 500);
+
+	// Layer 1's chord on A only counts while F holds the layer.
+	t = 5000;
+	Set(CTL_A, true, t);
+	CHECK_EQ(Buttons(t), 0);
+	Set(CTL_F, true, t);
+	CHECK_EQ(Buttons(t), 1 << 5);
+	Set(CTL_F, false, t);
+	CHECK_EQ(Buttons(t), 0);
+	Set(CTL_A, false, t);
+
+	// Inactive devices' controls count as released.
+	t = 6000;
+	Set(CTL_D, true, t);
+	Set(CTL_E, true, t);
+	CHECK_EQ(Buttons(t), 1 << 4);
+	dev->active = 0;
+	UpdateCombos(t);
+	CHECK_EQ(Buttons(t), 0);
+
+	ClearCombos();
+	delete dm;
+	dm = 0;
+	return TestResult();
+}
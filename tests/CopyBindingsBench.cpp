@@ -0,0 +1,113 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Times what a refresh costs with lots of devices and bindings: copying the
+// bindings over to placeholders, swapping the probed devices in for them,
+// activating everything on the first frame, and the frames after.  Checks
+// every binding makes it across.  Timings are printed, not checked, so load
+// on the machine can't fail it.
+
+#include "TestUtils.h"
+#include "Stats.h"
+
+#define BENCH_DEVICES 500
+// Bound per device, spread over every port and slot.
+#define BENCH_BINDINGS 40
+#define BENCH_FRAMES 100
+
+static int CountBindings(InputDeviceManager *m) {
+	int count = 0;
+	for (int i = 0; i < m->numDevices; i++) {
+		for (int port = 0; port < 2; port++) {
+			for (int slot = 0; slot < 4; slot++) {
+				count += m->devices[i]->pads[port][slot].numBindings;
+			}
+		}
+	}
+	return count;
+}
+
+// Same as BindCommand, without the config dialog's bookkeeping.
+static void Bind(Device *dev, int controlIndex, int port, int slot, int command) {
+	PadBindings *p = dev->pads[port] + slot;
+	p->bindings = (Binding*)realloc(p->bindings, (p->numBindings + 1) * sizeof(Binding));
+	Binding *b = p->bindings + p->numBindings++;
+	memset(b, 0, sizeof(*b));
+	b->controlIndex = controlIndex;
+	b->command = command;
+	b->sensitivity = BASE_SENSITIVITY;
+	b->deadZone = DEFAULT_DEADZONE;
+}
+
+int main() {
+	StartFakeDevices(BENCH_DEVICES);
+	CHECK_EQ(dm->numDevices, BENCH_DEVICES);
+
+	for (int i = 0; i < dm->numDevices; i++) {
+		Device *dev = dm->devices[i];
+		for (int j = 0; j < dev->numVirtualControls && j < BENCH_BINDINGS; j++)
+			Bind(dev, j, j & 1, (j >> 1) & 3, 0x10 + (j & 15));
+	}
+	bindingGeneration++;
+	int bound = CountBindings(dm);
+	printf("%d devices, %d bindings\n", dm->numDevices, bound);
+
+	// As EnumDevices() does it.  Nothing's been probed yet, so every bound
+	// device becomes a detached placeholder.
+	InputDeviceManager *oldDm = dm;
+	dm = new InputDeviceManager();
+	u64 start = MonotonicUs();
+	dm->CopyBindings(oldDm->numDevices, oldDm->devices);
+	u64 copyUs = MonotonicUs() - start;
+	CHECK_EQ(CountBindings(dm), bound);
+	delete oldDm;
+
+	EnumJoystickEvdev();
+	start = MonotonicUs();
+	AttachEnumeratedDevices();
+	u64 attachUs = MonotonicUs() - start;
+	CHECK_EQ(dm->numDevices, BENCH_DEVICES);
+	CHECK_EQ(CountBindings(dm), bound);
+	int attached = 0;
+	for (int i = 0; i < dm->numDevices; i++)
+		attached += dm->devices[i]->attached;
+	CHECK_EQ(attached, BENCH_DEVICES);
+
+	start = MonotonicUs();
+	RunDeviceFrame(0);
+	u64 activateUs = MonotonicUs() - start;
+	int active = 0;
+	for (int i = 0; i < dm->numDevices; i++)
+		active += dm->devices[i]->active;
+	CHECK_EQ(active, BENCH_DEVICES);
+
+	start = MonotonicUs();
+	for (int i = 1; i <= BENCH_FRAMES; i++)
+		RunDeviceFrame(i);
+	u64 frameUs = (MonotonicUs() - start) / BENCH_FRAMES;
+
+	printf("copy bindings: %llu us\n", (unsigned long long)copyUs);
+	printf("attach probed devices: %llu us\n", (unsigned long long)attachUs);
+	printf("first frame (activation): %llu us\n", (unsigned long long)activateUs);
+	printf("later frames: %llu us each\n", (unsigned long long)frameUs);
+
+	StopEnumeration();
+	delete dm;
+	dm = 0;
+	return TestResult();
+}
@@ -0,0 +1,74 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// LatencyHistogram's buckets: every value lands in a bucket whose middle is
+// within the promised error of it, buckets are in order, and percentiles
+// come out of the right bucket.
+
+#include "TestUtils.h"
+#include "Stats.h"
+
+// Checks v's bucket, and if lastIndex is given, that it's not before the
+// last value's.
+static void CheckValue(u64 v, int *lastIndex) {
+	int index = LatencyHistogram::BucketIndex(v);
+	CHECK(index >= 0 && index < LATENCY_BUCKETS);
+	if (lastIndex) {
+		CHECK(index >= *lastIndex);
+		*lastIndex = index;
+	}
+	u64 mid = LatencyHistogram::BucketValue(index);
+	u64 error = mid > v ? mid - v : v - mid;
+	// Half a bucket, and buckets are 1/16 of their power of two.
+	CHECK(error * 32 <= v || error == 0);
+	CHECK_EQ(LatencyHistogram::BucketIndex(mid), index);
+}
+
+int main() {
+	// Every value small enough to check them all, then either side of each
+	// power of two past that.
+	int last = 0;
+	for (u64 v = 0; v < 1 << 16; v++)
+		CheckValue(v, &last);
+	for (int bit = 16; bit < 32; bit++) {
+		u64 p = 1ULL << bit;
+		CheckValue(p - 1, 0);
+		CheckValue(p, 0);
+		CheckValue(p + 1, 0);
+	}
+	// Bucket middles map back to their own bucket.
+	for (int i = 0; i < LATENCY_BUCKETS; i++)
+		CHECK_EQ(LatencyHistogram::BucketIndex(LatencyHistogram::BucketValue(i)), i);
+	// Anything too big goes in the last bucket.
+	CHECK_EQ(LatencyHistogram::BucketIndex(0xFFFFFFFFULL), LATENCY_BUCKETS - 1);
+	CHECK_EQ(LatencyHistogram::BucketIndex(1ULL << 40), LATENCY_BUCKETS - 1);
+
+	// 1..1000 us, once each.
+	LatencyHistogram h;
+	memset(&h, 0, sizeof(h));
+	for (u64 v = 1; v <= 1000; v++)
+		h.Record(v);
+	CHECK_EQ(h.total, 1000);
+	CHECK_EQ(h.max, 1000);
+	u64 p50 = h.Percentile(0.5), p99 = h.Percentile(0.99);
+	CHECK(p50 >= 500 - 500 / 16 && p50 <= 500 + 500 / 16);
+	CHECK(p99 >= 990 - 990 / 16 && p99 <= 1000);
+	CHECK_EQ(h.Percentile(1), 1000);
+
+	return TestResult();
+}
@@ -0,0 +1,133 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// The log ring: records come out formatted as they were logged, strings
+// are copied when logged, a full ring drops and counts rather than blocks,
+// records from several threads all come out, each thread's in order, and
+// stopping the way DllMain does still writes everything out.
+// The writer thread writes to stderr on Linux, so that's pointed at a file
+// while it runs.
+
+#include "TestUtils.h"
+#include "Log.h"
+
+#include <thread>
+#include <unistd.h>
+
+#define LOG_THREADS 4
+// All of them together fit in the ring, so none should be dropped.
+#define LOG_THREAD_RECORDS 200
+#define LOG_FILL 4096
+
+int main() {
+	char path[] = "/tmp/lilypad_logringXXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	if (fd < 0) return TestResult();
+	fflush(stderr);
+	int savedStderr = dup(2);
+	dup2(fd, 2);
+	close(fd);
+
+	// Nothing's draining yet, so these stay in the ring.
+	char name[16];
+	strcpy(name, "before");
+	LogWrite(LOGCAT_GENERAL, LOGLEVEL_INFO, "size_t %d, string %s, double %.2f\n", (size_t)12345678901ULL, name, 0.5);
+	strcpy(name, "after");
+	int accepted = 1, dropped = 0;
+	for (int i = 0; i < LOG_FILL; i++) {
+		LogRecord *r = LogAcquire(LOGCAT_GENERAL, LOGLEVEL_INFO, "fill %d\n");
+		if (!r) {
+			dropped++;
+			continue;
+		}
+		r->AddAll(i);
+		LogCommit(r);
+		accepted++;
+	}
+	// Starting and stopping the writer empties the ring.
+	LogConfigure(0);
+	LogStop();
+
+	LogConfigure(0);
+	std::thread threads[LOG_THREADS];
+	for (int t = 0; t < LOG_THREADS; t++) {
+		threads[t] = std::thread([t]() {
+			for (int n = 0; n < LOG_THREAD_RECORDS; n++)
+				LogWrite(LOGCAT_GENERAL, LOGLEVEL_INFO, "thread %d record %d\n", t, n);
+		});
+	}
+	for (int t = 0; t < LOG_THREADS; t++)
+		threads[t].join();
+	LogStop();
+
+	// As DllMain stops it: the writer's left running to exit on its own,
+	// but what's queued still gets written.
+	LogConfigure(0);
+	LogWrite(LOGCAT_GENERAL, LOGLEVEL_INFO, "unloading\n");
+	LogStop(true);
+	LogWrite(LOGCAT_GENERAL, LOGLEVEL_INFO, "after unloading\n");
+	LogStop(true);
+	fflush(stderr);
+	dup2(savedStderr, 2);
+	close(savedStderr);
+	CHECK(dropped > 0);
+
+	FILE *in = fopen(path, "r");
+	CHECK(in != 0);
+	if (!in) return TestResult();
+	char line[256];
+	int typed = 0, fills = 0, droppedLines = 0, unloading = 0;
+	int next[LOG_THREADS] = {0};
+	while (fgets(line, sizeof(line), in)) {
+		int a, b;
+		if (!strcmp(line, "size_t 12345678901, string before, double 0.50\n")) {
+			CHECK_EQ(fills, 0);
+			typed++;
+		}
+		else if (!strcmp(line, "unloading\n") || !strcmp(line, "after unloading\n")) {
+			unloading++;
+		}
+		else if (sscanf(line, "fill %d", &a) == 1) {
+			CHECK_EQ(a, fills);
+			fills++;
+		}
+		else if (sscanf(line, "%d log records dropped", &a) == 1) {
+			CHECK_EQ(a, dropped);
+			droppedLines++;
+		}
+		else if (sscanf(line, "thread %d record %d", &a, &b) == 2 && a >= 0 && a < LOG_THREADS) {
+			CHECK_EQ(b, next[a]);
+			next[a] = b + 1;
+		}
+		else {
+			fprintf(stderr, "unexpected line: %s", line);
+			testFailures++;
+		}
+	}
+	fclose(in);
+	unlink(path);
+
+	CHECK_EQ(typed, 1);
+	CHECK_EQ(fills + 1, accepted);
+	CHECK_EQ(droppedLines, 1);
+	CHECK_EQ(unloading, 2);
+	for (int t = 0; t < LOG_THREADS; t++)
+		CHECK_EQ(next[t], LOG_THREAD_RECORDS);
+	return TestResult();
+}
@@ -0,0 +1,133 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// A polled device that gets slow is quarantined after POLL_STRIKES slow
+// updates, polled rarely while it stays slow, and let go once it's fast
+// again.  Then it deactivates itself on its worker, which the next frame
+// has to clean up and activate again.  Last, it's stopped the way DllMain
+// does it.
+
+#include "TestUtils.h"
+#include "DevicePoller.h"
+#include "Stats.h"
+
+#include <atomic>
+#include <unistd.h>
+
+#define SLOW_HZ 500
+
+class SlowDevice : public Device {
+public:
+	std::atomic<u32> updateUs{0};
+	std::atomic<bool> quit{false};
+
+	SlowDevice() : Device(LNX_KEYBOARD, OTHER, L"Slow Device", L"Slow Device") {
+		AddPhysicalControl(PSHBTN, 0, 0);
+		pollHz = SLOW_HZ;
+	}
+
+	int Activate(InitInfo *args) {
+		AllocState();
+		active = 1;
+		return 1;
+	}
+
+	int Update() {
+		if (quit) {
+			Deactivate();
+			return 0;
+		}
+		u32 us = updateUs;
+		if (us) usleep(us);
+		return active;
+	}
+};
+
+static u64 Quarantines() {
+	char stats[4096];
+	FormatStats(stats, sizeof(stats));
+	const char *line = strstr(stats, "poll_quarantines ");
+	return line ? strtoull(line + strlen("poll_quarantines "), 0, 10) : ~0ULL;
+}
+
+static u64 Updates(Device *dev) {
+	return dev->statUpdates.load();
+}
+
+// Runs frames for ms, at about 100 Hz.
+static void RunFrames(int ms) {
+	for (int i = 0; i < ms / 10; i++) {
+		RunDeviceFrame(0);
+		usleep(10000);
+	}
+}
+
+int main() {
+	dm = new InputDeviceManager();
+	SlowDevice *dev = new SlowDevice();
+	dm->AddDevice(dev);
+	dm->EnableDevice(0);
+
+	RunFrames(100);
+	CHECK(dev->active);
+	CHECK(dev->poller != 0);
+	u64 fast = Updates(dev);
+	// Polled at its own rate, not the frame rate.  Loose, for slow machines.
+	CHECK(fast > SLOW_HZ / 10 / 2);
+	CHECK_EQ(Quarantines(), 0);
+
+	// Slow enough to strike out in a few updates, then stays slow.
+	dev->updateUs = 3 * POLL_BUDGET_US;
+	RunFrames(POLL_QUARANTINE_MS * 3);
+	CHECK_EQ(Quarantines(), 1);
+	u64 slow = Updates(dev) - fast;
+	// The strikes, then one every POLL_QUARANTINE_MS, doubling.
+	CHECK(slow >= POLL_STRIKES && slow <= POLL_STRIKES + 4);
+	printf("%llu updates at full rate in 100 ms, %llu while slow for %d ms\n",
+		(unsigned long long)fast, (unsigned long long)slow, POLL_QUARANTINE_MS * 3);
+
+	// Fast again.  The next quarantined poll lets it go, and it's back to
+	// its own rate.
+	dev->updateUs = 0;
+	RunFrames(POLL_QUARANTINE_MS * 4 + 100);
+	u64 before = Updates(dev);
+	RunFrames(100);
+	CHECK(Updates(dev) - before > SLOW_HZ / 10 / 2);
+	CHECK_EQ(Quarantines(), 1);
+
+	// Deactivating on the worker leaves the state for the frame to free.
+	dev->quit = true;
+	while (!PollingStopped(dev))
+		usleep(1000);
+	CHECK(!dev->active);
+	dev->quit = false;
+	RunDeviceFrame(0);
+	CHECK(dev->active);
+	CHECK(dev->poller != 0);
+	CHECK(dev->virtualControlState != 0);
+
+	// From DllMain, the worker's detached once it's out of its loop, not
+	// joined.
+	SetPollingUnloading();
+	StopPolling(dev);
+	CHECK(dev->poller == 0);
+
+	delete dm;
+	dm = 0;
+	return TestResult();
+}
@@ -0,0 +1,88 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Once devices are active and have seen some input, a frame shouldn't touch
+// the heap, however much input there is.  Runs frames with every kind of
+// fake device getting input every frame, and checks the thread running
+// them allocates nothing.  Only built with LILYPAD_ALLOC_STATS.
+
+#include "TestUtils.h"
+#include "Stats.h"
+
+#define STEADY_DEVICES 8
+#define WARMUP_FRAMES 50
+#define STEADY_FRAMES 500
+
+// Pushing input allocates too, so only RunDeviceFrame() is counted.
+static u64 CountedFrame(FakeEvdevIO *io, int frame) {
+	for (int node = 0; node < STEADY_DEVICES; node++) {
+		switch (node % 4) {
+			case 0:
+			case 1:
+				io->PushEvent(node, EV_KEY, BTN_SOUTH, frame & 1);
+				io->PushEvent(node, EV_ABS, ABS_X, (frame * 37) % 256);
+				break;
+			case 2:
+				io->PushEvent(node, EV_KEY, KEY_A + frame % 20, 1);
+				io->PushEvent(node, EV_KEY, KEY_A + (frame + 19) % 20, 0);
+				break;
+			case 3:
+				io->PushEvent(node, EV_REL, REL_X, frame & 1 ? 5 : -5);
+				io->PushEvent(node, EV_KEY, BTN_LEFT, frame & 1);
+				break;
+		}
+		io->PushEvent(node, EV_SYN, SYN_REPORT, 0);
+	}
+	u64 before = ThreadAllocations();
+	RunDeviceFrame((u32)frame * 16);
+	return ThreadAllocations() - before;
+}
+
+int main() {
+	u64 before = ThreadAllocations();
+	int *counted = new int[4];
+	delete[] counted;
+	CHECK_EQ(ThreadAllocations() - before, 1);
+
+	FakeEvdevIO *io = StartFakeDevices(STEADY_DEVICES);
+	CHECK_EQ(dm->numDevices, STEADY_DEVICES);
+
+	u64 warmup = 0;
+	for (int frame = 0; frame < WARMUP_FRAMES; frame++)
+		warmup += CountedFrame(io, frame);
+	int active = 0;
+	for (int i = 0; i < dm->numDevices; i++)
+		active += dm->devices[i]->active;
+	CHECK_EQ(active, STEADY_DEVICES);
+	// Activation allocates, so this makes sure it's being counted at all.
+	CHECK(warmup > 0);
+
+	u64 steady = 0;
+	for (int frame = WARMUP_FRAMES; frame < WARMUP_FRAMES + STEADY_FRAMES; frame++)
+		steady += CountedFrame(io, frame);
+	printf("%llu allocations warming up, %llu in %d steady frames\n",
+		(unsigned long long)warmup, (unsigned long long)steady, STEADY_FRAMES);
+	CHECK_EQ(steady, 0);
+	for (int i = 0; i < dm->numDevices; i++)
+		CHECK(dm->devices[i]->statInputs.load() >= STEADY_FRAMES);
+
+	StopEnumeration();
+	delete dm;
+	dm = 0;
+	return TestResult();
+}
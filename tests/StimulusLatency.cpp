@@ -0,0 +1,125 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Latency from a fake pad's button changing to a host seeing it, with the
+// host reading at 60, 120, 250 and 1000 Hz.  The button toggles every four
+// host frames, so every change should be seen, within about a frame.
+// Bounds are loose enough for a loaded machine.
+
+#include "TestUtils.h"
+#include "Stats.h"
+
+#include <math.h>
+#include <unistd.h>
+
+// Stimulus transitions measured at each rate.
+#define STIM_SAMPLES 40
+
+static void MeasureLatency(int hostHz) {
+	FakeEvdevIO *io = StartFakeDevices(1);
+	CHECK_EQ(dm->numDevices, 1);
+	Device *pad = dm->devices[0];
+	// Activates the pad, so it's reading by the time the button changes.
+	RunDeviceFrame(0);
+	CHECK(pad->active);
+
+	int stimHz = hostHz / 4;
+	io->StartStimulus(0, BTN_SOUTH, stimHz);
+
+	u64 period = 1000000 / hostHz;
+	u64 start = MonotonicUs();
+	u64 end = start + STIM_SAMPLES * 1000000ULL / stimHz;
+	u64 next = start;
+	int lastState = 0;
+	u32 seenTransitions = 0;
+	u32 frames = 0, samples = 0, missed = 0;
+	double sum = 0, sumSquares = 0;
+	u64 maxLatency = 0;
+
+	while (1) {
+		u64 now = MonotonicUs();
+		if (now < next) {
+			usleep(next - now);
+			continue;
+		}
+		if (now >= end) break;
+		next += period;
+
+		// The button can change during the frame.  The count's odd while it's
+		// held, so whichever record matches what the frame saw is the one it
+		// saw.  Transitions are frames apart, so it's one of these two.
+		u32 transitions, after;
+		u64 stimTime, afterTime;
+		io->GetStimulus(&transitions, &stimTime);
+		RunDeviceFrame((u32)(now / 1000));
+		frames++;
+		io->GetStimulus(&after, &afterTime);
+		now = MonotonicUs();
+
+		// BTN_SOUTH is the pad's first button.
+		int state = pad->virtualControlState[0] > FULLY_DOWN / 2;
+		if ((int)(after & 1) == state) {
+			transitions = after;
+			stimTime = afterTime;
+		}
+		u32 pending = (transitions - seenTransitions) & STIM_COUNT_MASK;
+		if (state != lastState) {
+			u64 latency = now - stimTime;
+			samples++;
+			sum += latency;
+			sumSquares += (double)latency * latency;
+			if (latency > maxLatency) maxLatency = latency;
+			// Anything before the last transition came and went unseen.
+			if (pending > 1) missed += pending - 1;
+			seenTransitions = transitions;
+			lastState = state;
+		}
+		else if (pending >= 2) {
+			// Pressed and released between reads.
+			missed += pending & ~1;
+			seenTransitions += pending & ~1;
+		}
+	}
+
+	double mean = samples ? sum / samples : 0;
+	// Rounding can take this a little under 0 when every sample's the same.
+	double variance = samples ? sumSquares / samples - mean * mean : 0;
+	if (variance < 0) variance = 0;
+	double jitter = sqrt(variance);
+	printf("%4d Hz host, %3d Hz stimulus: %u frames, %u seen, %u missed, latency avg %.0f max %llu us, jitter %.0f us\n",
+		hostHz, stimHz, frames, samples, missed, mean, (unsigned long long)maxLatency, jitter);
+
+	CHECK(samples >= STIM_SAMPLES / 2);
+	CHECK(missed * 4 <= samples);
+	CHECK(mean <= 2 * period + 5000);
+	CHECK(maxLatency <= 3 * period + 20000);
+	CHECK(jitter >= 0);
+
+	StopEnumeration();
+	delete dm;
+	dm = 0;
+	evdev_io = 0;
+	delete io;
+}
+
+int main() {
+	static const int rates[] = {60, 120, 250, 1000};
+	for (int i = 0; i < 4; i++)
+		MeasureLatency(rates[i]);
+	return TestResult();
+}
@@ -0,0 +1,81 @@
+/*  LilyPad - Pad plugin for PS2 Emulator
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team/ChickenLiver
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the
+ *  terms of the GNU Lesser General Public License as published by the Free
+ *  Software Found- ation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PCSX2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Shared by the tests.  Each test is its own program, and returns
+// TestResult() from main.
+
+#include "Global.h"
+#include "InputManager.h"
+#include "DeviceEnumerator.h"
+#include "Combo.h"
+#include "Linux/EvdevIO.h"
+#include "Linux/JoyEvdev.h"
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+// Failures are printed and counted, and the test carries on.
+#define CHECK(cond)                                                       \
+	do {                                                                  \
+		if (!(cond)) {                                                    \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                  \
+			        __FILE__, __LINE__, #cond);                           \
+			testFailures++;                                               \
+		}                                                                 \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                    \
+	do {                                                                  \
+		long long _a = (long long)(a), _b = (long long)(b);               \
+		if (_a != _b) {                                                   \
+			fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+			        __FILE__, __LINE__, #a, #b, _a, _b);                  \
+			testFailures++;                                               \
+		}                                                                 \
+	} while (0)
+
+static inline int TestResult() {
+	if (testFailures) fprintf(stderr, "%d check(s) failed\n", testFailures);
+	return testFailures ? 1 : 0;
+}
+
+// Points evdev_io at a FakeEvdevIO with count devices, and probes them into
+// a fresh dm the way the background enumeration does.  Devices are attached
+// and enabled, but not activated until the first frame.
+static inline FakeEvdevIO *StartFakeDevices(int count) {
+	FakeEvdevIO *io = new FakeEvdevIO();
+	io->AddDevices(count);
+	evdev_io = io;
+	dm = new InputDeviceManager();
+	EnumJoystickEvdev();
+	AttachEnumeratedDevices();
+	return io;
+}
+
+// What PADpoll does with devices each frame, short of evaluating bindings,
+// which needs the rest of the plugin.  now is in ms, for combos.
+static inline void RunDeviceFrame(u32 now) {
+	InitInfo info = {0, 0, 0, 0};
+	AttachEnumeratedDevices();
+	dm->Update(&info);
+	UpdateCombos(now);
+	dm->PostRead();
+}